@@ -12,6 +12,7 @@
 
 #include "uv_command.h"
 
+#include <primitives/debug.h>
 #include <primitives/exceptions.h>
 #include <primitives/templates.h>
 
@@ -320,7 +321,12 @@ void Command::execute1(std::error_code *ec_in)
         return prev->execute1(ec_in);
         //throw SW_RUNTIME_ERROR("Do not run piped commands manually");
 
-    auto cmds = execute2(ec_in);
+    auto cmds = [this, ec_in]
+    {
+        // let thread pools start more workers while we wait for processes
+        primitives::ScopedBlockingRegion br;
+        return execute2(ec_in);
+    }();
     if (ec_in && *ec_in)
         return;
 
@@ -12,17 +12,23 @@
 #include <primitives/thread.h>
 
 #include <chrono>
+#include <concepts>
 #include <condition_variable>
 #include <functional>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <unordered_map>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER2(cron);
 
 class Cron
 {
+    struct State;
+    struct Timers;
+
 public:
     using Clock = std::chrono::system_clock;
     using TimePoint = Clock::time_point;
@@ -41,63 +47,137 @@ public:
                 : day(d), hour(h), min(m), second(s)
             {}
 
-            bool need_repeat()
+            bool need_repeat() const
             {
                 return second > 0 || min > 0 || hour > 0 || day > 0;
             }
 
-            TimePoint next_repeat(const TimePoint &from = Clock::now())
+            Clock::duration interval() const
             {
-                auto tp = from;
-                tp += std::chrono::hours(24 * day) +
+                return std::chrono::hours(24 * day) +
                     std::chrono::hours(hour) +
                     std::chrono::minutes(min) +
                     std::chrono::seconds(second);
-                return tp;
+            }
+
+            TimePoint next_repeat(const TimePoint &from = Clock::now()) const
+            {
+                return from + interval();
+            }
+
+            /// first tick after from on the grid of the original start, so repetitions do not drift;
+            /// missed ticks are not made up to prevent multiple instant calls
+            TimePoint next_repeat(const TimePoint &start, const TimePoint &from) const
+            {
+                if (from < start)
+                    return start;
+                auto d = interval();
+                return start + ((from - start) / d + 1) * d;
             }
         };
 
         Task task;
         Repeat repeat;
         int skip;
+        /// skip a tick while the previous one is still running instead of running them together
+        bool coalesce = false;
     };
 
-    using TaskQueue = std::map<TimePoint, CronTask>;
+    /// Cancels a pushed task. Already running tick is not interrupted.
+    struct Handle
+    {
+        /// returns false if the task has been cancelled already
+        bool cancel();
+
+        bool cancelled() const;
+
+    private:
+        friend class Cron;
+
+        std::shared_ptr<State> s;
+    };
+
+    using TaskQueue = std::multimap<TimePoint, std::shared_ptr<State>>;
     using Lock = std::unique_lock<std::mutex>;
 
 public:
-    Cron(auto &&executor)
+    /// By default tasks wait in the executor timer wheel.
+    /// own_thread - keep them in a separate cron thread instead (the only mode before timers).
+    Cron(Executor &e, bool own_thread = false)
+    {
+        if (own_thread)
+            start([&e](Task &&t) { e.push(std::move(t)); });
+        else
+            timers = std::make_shared<Timers>(e);
+    }
+    /// Any other executor with push(F): tasks wait in a separate cron thread.
+    template <class E>
+    requires (!std::derived_from<std::remove_cvref_t<E>, Executor>)
+    Cron(E &&executor)
     {
-        t = make_thread([&] { run(executor); });
+        start([&executor](Task &&t) { executor.push(std::move(t)); });
     }
     ~Cron()
     {
         stop();
-        t.join();
+        if (t.joinable())
+            t.join();
     }
 
-    void push(const TimePoint &p, const Task &t)
+    Handle push(const TimePoint &p, const Task &t)
     {
         CronTask::Repeat r;
-        push(p, t, r);
+        return push(p, t, r);
     }
 
-    void push(const TimePoint &p, const Task &t, const CronTask::Repeat &r, int skip = 1)
+    Handle push(const TimePoint &p, const Task &t, const CronTask::Repeat &r, int skip = 1)
     {
         CronTask ct;
         ct.repeat = r;
         ct.task = t;
         ct.skip = skip;
+        return push(p, std::move(ct));
+    }
+
+    Handle push(const TimePoint &p, CronTask ct)
+    {
+        Handle h;
+        h.s = std::make_shared<State>();
+        h.s->ct = std::move(ct);
+        h.s->start = p;
+        h.s->timers = timers;
+
+        if (timers)
+        {
+            Lock lock(timers->m);
+            if (!timers->done)
+                schedule(timers, h.s, p);
+            return h;
+        }
 
         {
             Lock lock(m);
-            tasks.emplace(p, std::move(ct));
+            tasks.emplace(p, h.s);
         }
         cv.notify_one();
+        return h;
     }
 
     void stop()
     {
+        if (timers)
+        {
+            std::unordered_map<State *, TimerHandle> pending;
+            {
+                Lock lock(timers->m);
+                timers->done = true;
+                pending = std::move(timers->pending);
+            }
+            for (auto &[_, h] : pending)
+                h.cancel();
+            return;
+        }
+
         {
             Lock lock(m);
             done = true;
@@ -106,13 +186,90 @@ public:
     }
 
 private:
+    struct State
+    {
+        CronTask ct;
+        // repetitions are counted from here
+        TimePoint start;
+        std::weak_ptr<Timers> timers;
+        std::atomic_bool cancelled = false;
+        std::atomic_bool running = false;
+
+        // decides about the current tick and the next one, called under cron lock
+        bool tick(std::optional<TimePoint> &next)
+        {
+            bool fire = ct.skip <= 0;
+            if (!fire)
+                ct.skip--;
+            if (ct.repeat.need_repeat())
+                next = ct.repeat.next_repeat(start, Clock::now());
+            return fire;
+        }
+
+        void execute()
+        {
+            if (cancelled)
+                return;
+            // previous tick is still running
+            if (ct.coalesce && running.exchange(true))
+                return;
+            SCOPE_EXIT
+            {
+                if (ct.coalesce)
+                    running = false;
+            };
+            ct.task();
+        }
+    };
+
+    // tasks in executor timers, shared with them, so cron may be destroyed before they fire
+    struct Timers
+    {
+        Executor &e;
+        std::mutex m;
+        std::unordered_map<State *, TimerHandle> pending;
+        bool done = false;
+
+        Timers(Executor &e) : e(e) {}
+    };
+
+    std::shared_ptr<Timers> timers;
+    // own thread mode
+    std::function<void(Task &&)> push_task;
     std::thread t;
     std::mutex m;
     std::condition_variable cv;
     TaskQueue tasks;
     bool done = false;
 
-    void run(auto &&executor)
+    // under timers lock
+    static void schedule(const std::shared_ptr<Timers> &t, const std::shared_ptr<State> &s, const TimePoint &p)
+    {
+        auto f = t->e.push_at(p, [t, s]
+        {
+            std::optional<TimePoint> next;
+            {
+                Lock lock(t->m);
+                if (t->done || s->cancelled)
+                    return;
+                t->pending.erase(s.get());
+                if (!s->tick(next))
+                    return;
+                if (next)
+                    schedule(t, s, *next);
+            }
+            s->execute();
+        });
+        t->pending.insert_or_assign(s.get(), f.handle);
+    }
+
+    void start(std::function<void(Task &&)> f)
+    {
+        push_task = std::move(f);
+        t = make_thread([this] { run(); });
+    }
+
+    void run()
     {
         while (!done)
         {
@@ -128,23 +285,20 @@ private:
                 auto p = i->first;
                 if (p <= Clock::now())
                 {
-                    auto t = std::move(i->second);
+                    auto s = std::move(i->second);
                     tasks.erase(i);
 
-                    bool fire = t.skip <= 0;
-                    if (!fire)
-                        t.skip--;
-
-                    if (t.repeat.need_repeat())
+                    std::optional<TimePoint> next;
+                    if (!s->cancelled)
                     {
-                        // repeat not from last fire time, but from now() to prevent multiple instant calls
-                        auto p2 = t.repeat.next_repeat();
-                        tasks.emplace(p2, t);
+                        bool fire = s->tick(next);
+                        if (next)
+                            tasks.emplace(*next, s);
+                        if (fire)
+                            push_task([s] { s->execute(); });
                     }
-                    if (fire)
-                        executor.push([t = std::move(t.task)] { t(); });
                 }
-                if (!tasks.empty() || !done)
+                if (!tasks.empty() && !done)
                     cv.wait_until(lock, tasks.begin()->first, [this] { return tasks.begin()->first <= Clock::now() || done; });
             }
             catch (const std::exception &e)
@@ -162,3 +316,29 @@ private:
         }
     }
 };
+
+inline bool Cron::Handle::cancel()
+{
+    if (!s || s->cancelled.exchange(true))
+        return false;
+    // drop the pending timer now, the own thread drops the task when its time comes
+    if (auto t = s->timers.lock())
+    {
+        TimerHandle h;
+        {
+            Lock lock(t->m);
+            auto i = t->pending.find(s.get());
+            if (i == t->pending.end())
+                return true;
+            h = i->second;
+            t->pending.erase(i);
+        }
+        h.cancel();
+    }
+    return true;
+}
+
+inline bool Cron::Handle::cancelled() const
+{
+    return s && s->cancelled;
+}
@@ -42,6 +42,48 @@ private:
     std::string old_thread_name;
 };
 
+/// Receives notifications about blocking calls (process waits, network) of the current thread,
+/// so a thread pool may start more threads meanwhile.
+struct BlockingRegionHandler
+{
+    virtual ~BlockingRegionHandler() = default;
+
+    virtual void beginBlockingRegion() = 0;
+    virtual void endBlockingRegion() = 0;
+};
+
+PRIMITIVES_DEBUG_API
+BlockingRegionHandler *getBlockingRegionHandler();
+
+// handler of the current thread, returns old one
+PRIMITIVES_DEBUG_API
+BlockingRegionHandler *setBlockingRegionHandler(BlockingRegionHandler *h);
+
+/// Mark a blocking call. Nested regions are counted once.
+struct ScopedBlockingRegion
+{
+    ScopedBlockingRegion()
+        : h(getBlockingRegionHandler())
+    {
+        if (!h)
+            return;
+        setBlockingRegionHandler(nullptr);
+        h->beginBlockingRegion();
+    }
+    ScopedBlockingRegion(const ScopedBlockingRegion &) = delete;
+    ScopedBlockingRegion &operator=(const ScopedBlockingRegion &) = delete;
+    ~ScopedBlockingRegion()
+    {
+        if (!h)
+            return;
+        h->endBlockingRegion();
+        setBlockingRegionHandler(h);
+    }
+
+private:
+    BlockingRegionHandler *h;
+};
+
 }
 
 #define PRIMITIVES_DO_WHILE(x) \
@@ -93,6 +93,20 @@ std::string getThreadName()
     return name;*/
 }
 
+static thread_local BlockingRegionHandler *blocking_region_handler = nullptr;
+
+BlockingRegionHandler *getBlockingRegionHandler()
+{
+    return blocking_region_handler;
+}
+
+BlockingRegionHandler *setBlockingRegionHandler(BlockingRegionHandler *h)
+{
+    auto old = blocking_region_handler;
+    blocking_region_handler = h;
+    return old;
+}
+
 std::string setThreadName(const std::string &name)
 {
     // disable for now, very very very slow
@@ -11,13 +11,20 @@
 #include <primitives/exceptions.h>
 #include <primitives/thread.h>
 
+#include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
 #include <queue>
+#include <ranges>
 #include <string>
 #include <tuple>
 #include <thread>
@@ -28,13 +35,135 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 //#include "log.h"
 //DECLARE_STATIC_LOGGER(logger, "executor");
 
-//
-using Task = std::function<void()>;
+/// Move-only type erased void() callable.
+/// Callables up to inline_size bytes are stored in place without allocations.
+class Task
+{
+public:
+    static constexpr size_t inline_size = 64;
+
+    Task() = default;
+    Task(std::nullptr_t) {}
+
+    template <class F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task> && std::is_invocable_v<std::decay_t<F> &>>>
+    Task(F &&f)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (is_inline<Fn>)
+            new (storage) Fn(std::forward<F>(f));
+        else
+            new (storage) Fn *(new Fn(std::forward<F>(f)));
+        ops = &ops_for<Fn>;
+    }
+
+    Task(Task &&rhs) noexcept
+    {
+        move_from(rhs);
+    }
+
+    Task &operator=(Task &&rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            reset();
+            move_from(rhs);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops->call(storage);
+    }
+
+    explicit operator bool() const { return ops; }
+
+    void reset()
+    {
+        if (ops)
+            ops->destroy(storage);
+        ops = nullptr;
+    }
+
+private:
+    struct Ops
+    {
+        void (*call)(void *);
+        void (*move)(void *from, void *to) noexcept;
+        void (*destroy)(void *) noexcept;
+    };
+
+    template <class F>
+    static constexpr bool is_inline =
+        sizeof(F) <= inline_size && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+
+    template <class F>
+    static F &get(void *p)
+    {
+        if constexpr (is_inline<F>)
+            return *std::launder(reinterpret_cast<F *>(p));
+        else
+            return **std::launder(reinterpret_cast<F **>(p));
+    }
+
+    template <class F>
+    static constexpr Ops ops_for =
+    {
+        [](void *p) { get<F>(p)(); },
+        [](void *from, void *to) noexcept
+        {
+            if constexpr (is_inline<F>)
+            {
+                new (to) F(std::move(get<F>(from)));
+                get<F>(from).~F();
+            }
+            else
+                new (to) F *(&get<F>(from));
+        },
+        [](void *p) noexcept
+        {
+            if constexpr (is_inline<F>)
+                get<F>(p).~F();
+            else
+                delete &get<F>(p);
+        },
+    };
+
+    void move_from(Task &rhs) noexcept
+    {
+        queued_at = rhs.queued_at;
+        ops = rhs.ops;
+        if (ops)
+            ops->move(rhs.storage, storage);
+        rhs.ops = nullptr;
+    }
+
+    alignas(std::max_align_t) std::byte storage[inline_size];
+    const Ops *ops = nullptr;
+
+public:
+    /// steady clock time in ns when the task was queued, set by executor for metrics
+    /// (after ops, so it takes the tail padding of storage)
+    int64_t queued_at = 0;
+};
+// tasks are moved through every queue, keep them small
+static_assert(sizeof(Task) <= 80);
 
 struct Executor;
 
@@ -69,9 +198,67 @@ inline size_t select_number_of_threads(int N = 0)
 //SW_DECLARE_GLOBAL_STATIC_FUNCTION2(Executor, default_executor_ptr, primitives::executor)
 //SW_DEFINE_GLOBAL_STATIC_FUNCTION2(Executor, getExecutor, primitives::executor::default_executor_ptr)
 
+/// Parks a thread until notified.
+/// Based on atomic wait (futex on linux), so notifications are never lost:
+/// take a ticket with prepare(), check your condition, then wait(ticket).
+class Notifier
+{
+public:
+    uint32_t prepare() const
+    {
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void wait(uint32_t ticket) const
+    {
+        epoch.wait(ticket, std::memory_order_acquire);
+    }
+
+    /// atomic wait has no timeout, so timed waiters park on a condition variable
+    /// returns false on timeout
+    template <class Rep, class Period>
+    bool wait_for(uint32_t ticket, const std::chrono::duration<Rep, Period> &d)
+    {
+        ++timed_waiters;
+        std::unique_lock<std::mutex> lk(m);
+        auto r = cv.wait_for(lk, d, [this, ticket] { return epoch.load(std::memory_order_acquire) != ticket; });
+        lk.unlock();
+        --timed_waiters;
+        return r;
+    }
+
+    void notify()
+    {
+        epoch.fetch_add(1);
+        epoch.notify_one();
+        notify_timed();
+    }
+
+    void notify_all()
+    {
+        epoch.fetch_add(1);
+        epoch.notify_all();
+        notify_timed();
+    }
+
+private:
+    std::atomic<uint32_t> epoch{ 0 };
+    std::atomic_int timed_waiters{ 0 };
+    std::mutex m;
+    std::condition_variable cv;
+
+    void notify_timed()
+    {
+        // seq_cst: either we see the waiter or it sees the new epoch
+        if (!timed_waiters)
+            return;
+        std::unique_lock<std::mutex> lk(m);
+        cv.notify_all();
+    }
+};
+
 class TaskQueue
 {
-    using Tasks = std::deque<Task>;
     using Lock = std::unique_lock<std::mutex>;
 
 public:
@@ -79,31 +266,32 @@ public:
     TaskQueue(TaskQueue &&rhs)
     {
         Lock lock(rhs.m);
-        q = std::move(rhs.q);
+        ring = std::move(rhs.ring);
+        head = rhs.head;
+        n = rhs.n.load();
+        rhs.n = 0;
     }
 
     bool try_push(Task &&t)
     {
         if (done_)
             return false;
-        {
-            Lock lock(m, std::try_to_lock);
-            if (!lock)
-                return false;
-            q.emplace_back(std::move(t));
-        }
-        cv.notify_one();
+        Lock lock(m, std::try_to_lock);
+        if (!lock)
+            return false;
+        emplace(std::move(t));
         return true;
     }
 
     bool try_pop(Task &t, std::atomic_bool &busy)
     {
+        if (empty())
+            return false;
         Lock lock(m, std::try_to_lock);
-        if (!lock || q.empty() || done_)
+        if (!lock || empty() || done_)
             return false;
-        t = std::move(q.front());
+        t = take();
         busy = true;
-        q.pop_front();
         return true;
     }
 
@@ -111,50 +299,192 @@ public:
     {
         if (done_)
             return;
+        Lock lock(m);
+        emplace(std::move(t));
+    }
+
+    void done()
+    {
+        Lock lock(m);
+        done_ = true;
+    }
+
+    bool empty() const
+    {
+        return n == 0;
+    }
+
+    size_t size() const
+    {
+        return n;
+    }
+
+private:
+    // ring buffer grows but never shrinks, so steady state pushes do not allocate
+    std::vector<Task> ring;
+    size_t head = 0;
+    std::mutex m;
+    std::atomic_size_t n{ 0 };
+    std::atomic_bool done_{ false };
+
+    void emplace(Task &&t)
+    {
+        if (n == ring.size())
         {
-            Lock lock(m);
-            q.emplace_back(std::move(t));
+            std::vector<Task> r(std::max<size_t>(16, ring.size() * 2));
+            for (size_t i = 0; i < n; i++)
+                r[i] = std::move(ring[(head + i) % ring.size()]);
+            ring.swap(r);
+            head = 0;
         }
-        cv.notify_one();
+        ring[(head + n) % ring.size()] = std::move(t);
+        ++n;
     }
 
-    bool pop(Task &t, std::atomic_bool &busy)
+    Task take()
     {
-        Lock lock(m);
-        while (q.empty() && !done_)
-            cv.wait(lock);
-        if (q.empty() || done_)
-            return false;
-        t = std::move(q.front());
-        busy = true;
-        q.pop_front();
-        return true;
+        auto t = std::move(ring[head]);
+        head = (head + 1) % ring.size();
+        --n;
+        return t;
     }
+};
 
-    void done()
+/// Chase-Lev work-stealing deque.
+/// Owner thread pushes and pops at the bottom (LIFO), other threads steal from the top (FIFO).
+/// push() and pop() must be called only by the owner, steal() - by anyone.
+/// T must be trivially copyable (usually a pointer).
+template <class T>
+class WorkStealingQueue
+{
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+    struct Array
     {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> data;
+
+        Array(int64_t capacity)
+            : capacity(capacity), mask(capacity - 1), data(new std::atomic<T>[capacity])
         {
-            Lock lock(m);
-            done_ = true;
         }
-        cv.notify_all();
+
+        T get(int64_t i) const { return data[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T v) { data[i & mask].store(v, std::memory_order_relaxed); }
+
+        Array *grow(int64_t b, int64_t t) const
+        {
+            auto a = new Array(capacity * 2);
+            for (auto i = t; i != b; ++i)
+                a->put(i, get(i));
+            return a;
+        }
+    };
+
+public:
+    WorkStealingQueue(int64_t capacity = 256)
+    {
+        if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+            throw SW_RUNTIME_ERROR("WorkStealingQueue capacity must be a power of two");
+        arrays.emplace_back(std::make_unique<Array>(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+    WorkStealingQueue(const WorkStealingQueue &) = delete;
+    WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+    void push(T v)
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            // old arrays are kept until destruction, thieves may still read from them
+            arrays.emplace_back(a->grow(b, t));
+            a = arrays.back().get();
+            array.store(a, std::memory_order_release);
+        }
+        a->put(b, v);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    bool pop(T &v)
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        v = a->get(b);
+        if (t == b)
+        {
+            // last element, race with thieves
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool steal(T &v)
+    {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        auto a = array.load(std::memory_order_acquire);
+        v = a->get(t);
+        // lost the race to another thief or to the owner
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
     }
 
     bool empty() const
     {
-        return q.empty();
+        return size() == 0;
+    }
+
+    size_t size() const
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
     }
 
 private:
-    Tasks q;
-    std::mutex m;
-    std::condition_variable cv;
-    bool done_ = false;
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Array *> array;
+    std::vector<std::unique_ptr<Array>> arrays;
 };
 
 template <class T>
 using SharedStatePtr = std::shared_ptr<SharedState<T>>;
 
+/// Intrusive node of the lock-free continuation stack of a shared state.
+/// Nodes are owned by whoever links them. The state calls fn(node, true) once it is set,
+/// or fn(node, false) when it is destroyed unset.
+struct Continuation
+{
+    void (*fn)(Continuation *, bool set) = nullptr;
+    Continuation *next = nullptr;
+
+    // stack head of a set state, nothing can be linked after it
+    static Continuation *closed()
+    {
+        static Continuation c;
+        return &c;
+    }
+};
+
 template <class T>
 struct SharedState
 {
@@ -163,9 +493,9 @@ struct SharedState
     using DataType = std::conditional_t<std::is_same_v<T, void>, VoidDataType, T>;
 
     Executor &e;
-    std::condition_variable cv;
-    std::vector<std::condition_variable*> cv_notifiers;
+    std::vector<Notifier*> notifiers;
     std::vector<Task> callbacks;
+    std::atomic<Continuation *> continuations{ nullptr };
     std::mutex m;
     typename SharedStatePtr<T>::weak_type w;
 
@@ -178,6 +508,12 @@ struct SharedState
         : e(rhs.e), set(rhs.set.load()), data(rhs.data), eptr(rhs.eptr)
     {
     }
+    ~SharedState()
+    {
+        auto c = continuations.load(std::memory_order_acquire);
+        if (c != Continuation::closed())
+            fire(c, false);
+    }
 
     FutureType getFuture()
     {
@@ -198,20 +534,73 @@ struct SharedState
 
     void notice()
     {
-        cv.notify_all();
-        // lock after not locked own notify
+        fire(continuations.exchange(Continuation::closed(), std::memory_order_acq_rel), true);
+
+        std::unique_lock<std::mutex> lk(m);
+        for (auto n : notifiers)
+            n->notify();
+        notifiers.clear();
+        auto cbs = std::move(callbacks);
+        callbacks.clear();
+        lk.unlock();
+
+        // callbacks may push into executor, so never run them under the lock
+        for (auto &cb : cbs)
         {
-            std::unique_lock<std::mutex> lk(m);
-            for (auto &cv : cv_notifiers)
-                cv->notify_all();
-            for (auto &cb : callbacks)
-            {
-                if (cb)
-                    cb();
-            }
+            if (cb)
+                cb();
+        }
+    }
+
+    /// lock-free, returns false if the state is already set, c is not linked then
+    bool add_continuation(Continuation &c)
+    {
+        auto h = continuations.load(std::memory_order_acquire);
+        do
+        {
+            if (h == Continuation::closed())
+                return false;
+            c.next = h;
+        } while (!continuations.compare_exchange_weak(h, &c, std::memory_order_acq_rel, std::memory_order_acquire));
+        return true;
+    }
+
+    /// returns false if the state is already set, callback is not added then
+    bool add_callback(Task &&cb)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        if (set)
+            return false;
+        callbacks.push_back(std::move(cb));
+        return true;
+    }
+
+    /// returns false if the state is already set
+    bool add_notifier(Notifier &n)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        if (set)
+            return false;
+        notifiers.push_back(&n);
+        return true;
+    }
+
+    void remove_notifier(Notifier &n)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        std::erase(notifiers, &n);
+    }
+
+private:
+    static void fire(Continuation *c, bool set)
+    {
+        while (c)
+        {
+            // node may be freed by its fn
+            auto next = c->next;
+            c->fn(c, set);
+            c = next;
         }
-        cv_notifiers.clear();
-        callbacks.clear();
     }
 };
 
@@ -264,95 +653,660 @@ struct Future
 template <class T>
 using Futures = std::vector<Future<T>>;
 
+/// shared state together with the callable, so a task needs only one allocation
 template <class F, class ... ArgTypes>
-struct PackagedTask
+struct PackagedTaskState : SharedState<std::invoke_result_t<F, ArgTypes...>>
 {
-    using Ret = typename std::invoke_result_t<F, ArgTypes...>;
-    using Task = std::function<Ret(ArgTypes...)>;
-    using FutureType = Future<Ret>;
-
-    PackagedTask(Executor &e, F f, ArgTypes && ...)
-        : t(f)
-    {
-        s = makeSharedState<Ret>(e);
-    }
+    using Ret = std::invoke_result_t<F, ArgTypes...>;
 
-    PackagedTask(const PackagedTask &rhs)
-        : t(rhs.t), s(rhs.s)
-    {
-    }
-    PackagedTask(PackagedTask &&rhs) = default;
+    std::optional<F> f;
+    std::tuple<ArgTypes...> args;
 
-    FutureType getFuture()
+    template <class F2, class ... ArgTypes2>
+    PackagedTaskState(Executor &e, F2 &&f, ArgTypes2 && ... args)
+        : SharedState<Ret>(e), f(std::forward<F2>(f)), args(std::forward<ArgTypes2>(args)...)
     {
-        return s->getFuture();
     }
 
-    void operator()(ArgTypes && ... args) const noexcept
+    void run() noexcept
     {
         try
         {
             if constexpr (std::is_same_v<Ret, void>)
-                t(std::forward<ArgTypes>(args)...);
+                std::apply(*f, std::move(args));
             else
-                s->data = std::move(t(std::forward<ArgTypes>(args)...));
+                this->data = std::apply(*f, std::move(args));
         }
         catch (...)
         {
-            s->eptr = std::current_exception();
+            this->eptr = std::current_exception();
         }
-        s->setExecuted();
+        // release captures as soon as possible
+        f.reset();
+        this->setExecuted();
     }
 
-private:
-    Task t;
-    mutable SharedStatePtr<Ret> s;
+    /// set the state without running the task
+    void cancel(std::exception_ptr e) noexcept
+    {
+        f.reset();
+        this->eptr = e;
+        this->setExecuted();
+    }
 };
 
-enum class WaitStatus
+template <class F, class ... ArgTypes>
+struct PackagedTask
 {
-    Running,
-    AllowIncoming,
-    BlockIncoming,
-    RejectIncoming,
+    using State = PackagedTaskState<std::decay_t<F>, std::decay_t<ArgTypes>...>;
+    using Ret = typename State::Ret;
+    using FutureType = Future<Ret>;
+
+    template <class F2, class ... ArgTypes2>
+    PackagedTask(Executor &e, F2 &&f, ArgTypes2 && ... args)
+        : s(std::make_shared<State>(e, std::forward<F2>(f), std::forward<ArgTypes2>(args)...))
+    {
+        s->w = s;
+    }
+
+    PackagedTask(const PackagedTask &rhs) = default;
+    PackagedTask(PackagedTask &&rhs) = default;
+
+    FutureType getFuture()
+    {
+        return s->getFuture();
+    }
+
+    void operator()() const noexcept
+    {
+        s->run();
+    }
+
+    void cancel(std::exception_ptr e) const noexcept
+    {
+        s->cancel(e);
+    }
+
+private:
+    std::shared_ptr<State> s;
 };
 
-struct Executor
+/// Power of two buckets: bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i).
+/// Written by a single thread, so increments need no read-modify-write.
+struct Histogram
 {
-    struct Thread
+    static constexpr size_t n_buckets = 48;
+
+    std::array<std::atomic_uint64_t, n_buckets> buckets{};
+
+    void add(uint64_t v)
     {
-        std::thread t;
-        TaskQueue q;
-        std::atomic_bool busy{ false };
+        auto &b = buckets[std::min<size_t>(std::bit_width(v), n_buckets - 1)];
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
 
-        Thread() = default;
-        Thread(const Thread &) {}
+    std::array<uint64_t, n_buckets> get() const
+    {
+        std::array<uint64_t, n_buckets> r;
+        for (size_t i = 0; i != n_buckets; ++i)
+            r[i] = buckets[i].load(std::memory_order_relaxed);
+        return r;
+    }
+};
 
-        bool empty() const { return q.empty(); }
+/// Snapshot of executor counters, times are in ns.
+struct ExecutorMetrics
+{
+    struct Worker
+    {
+        uint64_t tasks_executed = 0;
+        uint64_t steals = 0;
+        // steal attempts lost to the owner or other thieves
+        uint64_t failed_steals = 0;
+        uint64_t busy_ns = 0;
+        uint64_t idle_ns = 0;
+        uint64_t queue_high_water = 0;
+        std::array<uint64_t, Histogram::n_buckets> queue_wait_ns{};
+        std::array<uint64_t, Histogram::n_buckets> run_time_ns{};
     };
 
-    using Threads = std::vector<Thread>;
+    std::vector<Worker> workers;
 
-public:
-    Executor(size_t nThreads = std::thread::hardware_concurrency(), const std::string &name = "")
-        : nThreads(nThreads)
+    /// histograms are arrays of bucket counts, see Histogram for bucket bounds
+    std::string to_json() const
     {
-        // we keep this lock until all threads created and assigned to thread_pool var
+        auto hist = [](const auto &h)
+        {
+            // trailing empty buckets are not written
+            auto n = h.size();
+            while (n && !h[n - 1])
+                n--;
+            std::string s = "[";
+            for (size_t i = 0; i != n; ++i)
+            {
+                if (i)
+                    s += ",";
+                s += std::to_string(h[i]);
+            }
+            return s + "]";
+        };
+
+        std::string s = "{\"workers\":[";
+        for (size_t i = 0; i != workers.size(); ++i)
+        {
+            auto &w = workers[i];
+            if (i)
+                s += ",";
+            s += "{\"id\":" + std::to_string(i);
+            s += ",\"tasks_executed\":" + std::to_string(w.tasks_executed);
+            s += ",\"steals\":" + std::to_string(w.steals);
+            s += ",\"failed_steals\":" + std::to_string(w.failed_steals);
+            s += ",\"busy_ns\":" + std::to_string(w.busy_ns);
+            s += ",\"idle_ns\":" + std::to_string(w.idle_ns);
+            s += ",\"queue_high_water\":" + std::to_string(w.queue_high_water);
+            s += ",\"queue_wait_ns\":" + hist(w.queue_wait_ns);
+            s += ",\"run_time_ns\":" + hist(w.run_time_ns);
+            s += "}";
+        }
+        return s + "]}";
+    }
+};
+
+namespace detail
+{
+
+struct TimerLink
+{
+    TimerLink *prev = nullptr;
+    TimerLink *next = nullptr;
+};
+
+struct TimerNode : TimerLink
+{
+    // tick of expiration
+    uint64_t expires = 0;
+    // keeps the node alive while it is in the wheel
+    std::shared_ptr<TimerNode> self;
+
+    virtual ~TimerNode() = default;
+
+    // both are called without the wheel lock
+    virtual void fire() = 0;
+    virtual void cancel() noexcept = 0;
+};
+
+template <class PT>
+struct TimerTask;
+
+}
+
+/// Hierarchical timing wheel: 4 levels of 256 slots, the finest slot is 1 ms.
+/// Insert, cancel and expire are O(1), far timers are cascaded to lower levels when their slot comes.
+/// Expired timers are fired from the wheel thread, which is started on the first insert.
+struct TimerWheel
+{
+    using Clock = std::chrono::steady_clock;
+    using Node = detail::TimerNode;
+    using NodePtr = std::shared_ptr<Node>;
+
+    TimerWheel()
+    {
+        for (auto &level : wheel)
+        {
+            for (auto &s : level)
+                s.prev = s.next = &s;
+        }
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    ~TimerWheel()
+    {
+        stop();
+    }
+
+    void add(const NodePtr &n, Clock::time_point tp)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        if (stopped)
+        {
+            lk.unlock();
+            n->cancel();
+            return;
+        }
+        if (!t.joinable())
+            t = make_thread([this] { run(); });
+        n->expires = std::max(to_tick(tp), current + 1);
+        n->self = n;
+        link(n.get());
+        ++n_timers;
+        // the thread sleeps longer than needed
+        if (n->expires < wake_at)
+        {
+            wake_at = n->expires;
+            cv.notify_one();
+        }
+    }
+
+    /// returns false if the timer has already fired or has been cancelled
+    bool cancel(Node &n)
+    {
+        NodePtr self;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            if (!n.next)
+                return false;
+            unlink(&n);
+            --n_timers;
+            self = std::move(n.self);
+        }
+        self->cancel();
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::unique_lock<std::mutex> lk(m);
+        return n_timers;
+    }
+
+    /// cancels all pending timers
+    void stop()
+    {
+        std::vector<NodePtr> pending;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            stopped = true;
+            for (auto &level : wheel)
+            {
+                for (auto &s : level)
+                {
+                    while (s.next != &s)
+                    {
+                        auto n = static_cast<Node *>(s.next);
+                        unlink(n);
+                        pending.push_back(std::move(n->self));
+                    }
+                }
+            }
+            n_timers = 0;
+            cv.notify_all();
+        }
+        if (t.joinable() && t.get_id() != std::this_thread::get_id())
+            t.join();
+        for (auto &n : pending)
+            n->cancel();
+    }
+
+private:
+    static constexpr size_t bits = 8;
+    static constexpr size_t n_slots = 1 << bits;
+    static constexpr size_t n_levels = 4;
+    static constexpr uint64_t max_delta = (1ULL << (bits * n_levels)) - 1;
+    static constexpr uint64_t never = -1;
+
+    detail::TimerLink wheel[n_levels][n_slots];
+    const Clock::time_point start = Clock::now();
+    // last processed tick
+    uint64_t current = 0;
+    size_t n_timers = 0;
+    // the thread sleeps until this tick, 0 when it is awake
+    uint64_t wake_at = 0;
+    bool stopped = false;
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::thread t;
+
+    // never fire early
+    uint64_t to_tick(Clock::time_point tp) const
+    {
+        if (tp <= start)
+            return 0;
+        return std::chrono::ceil<std::chrono::milliseconds>(tp - start).count();
+    }
+
+    uint64_t now_tick() const
+    {
+        return std::chrono::floor<std::chrono::milliseconds>(Clock::now() - start).count();
+    }
+
+    static void unlink(detail::TimerLink *n)
+    {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        n->prev = n->next = nullptr;
+    }
+
+    void link(Node *n)
+    {
+        auto delta = n->expires - current;
+        size_t level = 0;
+        while (level + 1 < n_levels && delta >= 1ULL << (bits * (level + 1)))
+            level++;
+        // too far timers wait in the last slot and are re-linked when cascaded
+        auto e = std::min(n->expires, current + max_delta);
+        auto &s = wheel[level][(e >> (bits * level)) & (n_slots - 1)];
+        n->prev = s.prev;
+        n->next = &s;
+        s.prev->next = n;
+        s.prev = n;
+    }
+
+    void tick(std::vector<NodePtr> &expired)
+    {
+        ++current;
+        for (size_t level = 1; level < n_levels; level++)
+        {
+            if (current & ((1ULL << (bits * level)) - 1))
+                break;
+            auto &s = wheel[level][(current >> (bits * level)) & (n_slots - 1)];
+            // detach the slot, its nodes move to lower levels
+            detail::TimerLink l;
+            if (s.next == &s)
+                continue;
+            l.next = s.next;
+            l.prev = s.prev;
+            l.next->prev = l.prev->next = &l;
+            s.prev = s.next = &s;
+            while (l.next != &l)
+            {
+                auto n = static_cast<Node *>(l.next);
+                unlink(n);
+                link(n);
+            }
+        }
+        auto &s = wheel[0][current & (n_slots - 1)];
+        while (s.next != &s)
+        {
+            auto n = static_cast<Node *>(s.next);
+            unlink(n);
+            --n_timers;
+            expired.push_back(std::move(n->self));
+        }
+    }
+
+    // next tick with work: nearest non empty slot of the first level or the next cascade
+    uint64_t next_tick() const
+    {
+        auto end = (current | (n_slots - 1)) + 1;
+        for (auto i = current + 1; i < end; i++)
+        {
+            auto &s = wheel[0][i & (n_slots - 1)];
+            if (s.next != &s)
+                return i;
+        }
+        return end;
+    }
+
+    void run()
+    {
+        primitives::setThreadName("timer wheel");
+        std::vector<NodePtr> expired;
+        std::unique_lock<std::mutex> lk(m);
+        while (!stopped)
+        {
+            auto now = now_tick();
+            while (current < now)
+            {
+                if (!n_timers)
+                {
+                    current = now;
+                    break;
+                }
+                tick(expired);
+            }
+            if (!expired.empty())
+            {
+                lk.unlock();
+                for (auto &n : expired)
+                {
+                    try
+                    {
+                        n->fire();
+                    }
+                    catch (...)
+                    {
+                        n->cancel();
+                    }
+                }
+                expired.clear();
+                lk.lock();
+                continue;
+            }
+            if (!n_timers)
+            {
+                wake_at = never;
+                cv.wait(lk);
+            }
+            else
+            {
+                wake_at = next_tick();
+                cv.wait_until(lk, start + std::chrono::milliseconds(wake_at));
+            }
+            wake_at = 0;
+        }
+    }
+};
+
+/// Cancels a delayed task.
+struct TimerHandle
+{
+    TimerHandle() = default;
+    TimerHandle(TimerWheel &w, const std::shared_ptr<detail::TimerNode> &n)
+        : w(&w), n(n)
+    {
+    }
+
+    /// returns false if the task has already been started or cancelled
+    bool cancel()
+    {
+        auto p = n.lock();
+        return p && w->cancel(*p);
+    }
+
+private:
+    TimerWheel *w = nullptr;
+    std::weak_ptr<detail::TimerNode> n;
+};
+
+/// Future of a delayed task. After cancel() it throws.
+template <class T>
+struct DelayedFuture : Future<T>
+{
+    TimerHandle handle;
+
+    DelayedFuture(const Future<T> &f, const TimerHandle &h)
+        : Future<T>(f), handle(h)
+    {
+    }
+
+    bool cancel()
+    {
+        return handle.cancel();
+    }
+};
+
+enum class WaitStatus
+{
+    Running,
+    AllowIncoming,
+    BlockIncoming,
+    RejectIncoming,
+};
+
+/// what push() does when executor queues are full
+enum class OverflowPolicy
+{
+    // wait for free space; workers run their own tasks in place instead, so they never block
+    Block,
+    // throw
+    Reject,
+    // run the task in the calling thread, task affinity is ignored
+    RunInCaller,
+};
+
+enum class TaskPriority
+{
+    High,
+    Normal,
+    Low,
+};
+
+struct TaskOptions
+{
+    TaskPriority priority = TaskPriority::Normal;
+    /// run only on this worker
+    std::optional<size_t> worker;
+    /// run on any worker of this numa node, ignored when no pinned worker runs there
+    std::optional<int> numa_node;
+};
+
+struct Executor : private primitives::BlockingRegionHandler
+{
+    // deque slots must be trivially copyable, so tasks are boxed there;
+    // boxes are recycled through thread local caches, so steady state pushes do not allocate
+    struct TaskBox
+    {
+        Task t;
+        TaskBox *next = nullptr;
+    };
+
+    struct TaskBoxCache
+    {
+        static constexpr size_t max_size = 1024;
+
+        TaskBox *head = nullptr;
+        size_t n = 0;
+
+        ~TaskBoxCache()
+        {
+            while (head)
+                delete std::exchange(head, head->next);
+        }
+
+        TaskBox *get(Task &&t)
+        {
+            if (!head)
+                return new TaskBox{ std::move(t) };
+            auto b = std::exchange(head, head->next);
+            --n;
+            b->t = std::move(t);
+            return b;
+        }
+
+        Task put(TaskBox *b)
+        {
+            auto t = std::move(b->t);
+            if (n == max_size)
+                delete b;
+            else
+            {
+                b->next = std::exchange(head, b);
+                ++n;
+            }
+            return t;
+        }
+
+        static TaskBoxCache &get()
+        {
+            static thread_local TaskBoxCache c;
+            return c;
+        }
+    };
+
+    static constexpr size_t n_priorities = 3;
+
+    struct Thread
+    {
+        std::thread t;
+        // incoming tasks from other threads, by priority
+        TaskQueue q[n_priorities];
+        // tasks that can be run only by this worker, by priority
+        TaskQueue pinned[n_priorities];
+        // tasks for the numa node of this worker, any worker of the node can take them
+        TaskQueue node[n_priorities];
+        // normal priority tasks pushed by this worker, can be stolen by others
+        WorkStealingQueue<TaskBox *> d;
+        std::atomic_bool busy{ false };
+        std::atomic_bool sleeping{ false };
+        Notifier n;
+        // worker thread is running, extra workers of elastic executor come and go
+        std::atomic_bool active{ false };
+        // set when worker is pinned
+        int cpu = -1;
+        int numa_node = -1;
+
+        // metrics, written by this worker only (except queue_high_water)
+        std::atomic_uint64_t tasks_executed{ 0 };
+        std::atomic_uint64_t steals{ 0 };
+        std::atomic_uint64_t failed_steals{ 0 };
+        std::atomic_uint64_t busy_ns{ 0 };
+        std::atomic_uint64_t idle_ns{ 0 };
+        std::atomic_uint64_t queue_high_water{ 0 };
+        Histogram queue_wait;
+        Histogram run_time;
+
+        // total queued tasks, approximate
+        size_t size() const
+        {
+            size_t n = d.size();
+            for (size_t p = 0; p != n_priorities; ++p)
+                n += q[p].size() + pinned[p].size() + node[p].size();
+            return n;
+        }
+
+        Thread() = default;
+        Thread(const Thread &) {}
+        ~Thread()
+        {
+            TaskBox *t;
+            while (d.pop(t))
+                delete t;
+        }
+
+        bool empty() const
+        {
+            for (size_t p = 0; p != n_priorities; ++p)
+            {
+                if (!q[p].empty() || !pinned[p].empty() || !node[p].empty())
+                    return false;
+            }
+            return d.empty();
+        }
+    };
+
+    using Threads = std::vector<Thread>;
+
+public:
+    /// pin_threads - bind every worker to its own cpu (round-robin over allowed cpus)
+    /// max_threads - enables elastic mode when greater than nThreads:
+    /// extra workers are started while all running workers are inside blocking regions
+    /// (see primitives::ScopedBlockingRegion) and stop after being idle for idle timeout
+    Executor(size_t nThreads = std::thread::hardware_concurrency(), const std::string &name = "", bool pin_threads = false,
+        size_t max_threads = 0)
+        : nThreads(nThreads), max_threads(std::max(nThreads, max_threads)), name(name), pin_threads(pin_threads)
+    {
+        // we keep this lock until all threads created and assigned to thread_pool var
         // this is to prevent races on data objects
         std::unique_lock<std::mutex> lk(m);
 
         std::atomic<decltype(nThreads)> barrier{ 0 };
         std::atomic<decltype(nThreads)> barrier2{ 0 };
 
-        thread_pool.resize(nThreads);
+        // slots of extra workers are allocated upfront, so thread_pool never moves
+        thread_pool.resize(this->max_threads);
+        n_slots = nThreads;
+        n_running = nThreads;
         for (size_t i = 0; i < nThreads; i++)
         {
-            thread_pool[i].t = make_thread([this, i, name = name, &barrier, &barrier2, nThreads]() mutable
+            thread_pool[i].active = true;
+            thread_pool[i].t = make_thread([this, i, &barrier, &barrier2, nThreads]() mutable
             {
                 // set tids early
                 {
                     std::unique_lock<std::mutex> lk(m);
-                    thread_ids[std::this_thread::get_id()] = i;
+                    init_worker(i);
                     ++barrier;
                 }
 
@@ -364,61 +1318,281 @@ public:
                 ++barrier2;
 
                 // proceed
-                run(i, name);
+                run(i);
             });
         }
 
         // allow threads to run
         lk.unlock();
 
-        // wait when all threads set their tids
-        while (barrier2 != nThreads)
-            std::this_thread::sleep_for(std::chrono::microseconds(1));
-    }
-    Executor(const std::string &name, size_t nThreads = std::thread::hardware_concurrency())
-        : Executor(nThreads, name)
-    {
-    }
-    ~Executor()
-    {
-        join();
+        // wait when all threads set their tids
+        while (barrier2 != nThreads)
+            std::this_thread::sleep_for(std::chrono::microseconds(1));
+    }
+    Executor(const std::string &name, size_t nThreads = std::thread::hardware_concurrency(), bool pin_threads = false,
+        size_t max_threads = 0)
+        : Executor(nThreads, name, pin_threads, max_threads)
+    {
+    }
+    ~Executor()
+    {
+        join();
+    }
+
+    size_t numberOfThreads() const { return nThreads; }
+    size_t numberOfRunningThreads() const { return n_running; }
+
+    /// how long extra workers of elastic executor wait for work before they stop
+    void set_idle_timeout(std::chrono::milliseconds t) { idle_timeout = t; }
+
+    template <class F, class ... ArgTypes>
+    auto push(F &&f, ArgTypes && ... args)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        PackagedTask<F, ArgTypes...> pt(*this, std::move(f), std::forward<ArgTypes>(args)...);
+        return push(std::move(pt));
+    }
+
+    template <class F, class ... ArgTypes>
+    auto push(TaskOptions o, F &&f, ArgTypes && ... args)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        PackagedTask<F, ArgTypes...> pt(*this, std::move(f), std::forward<ArgTypes>(args)...);
+        return push(o, std::move(pt));
+    }
+
+    template <class F, class ... ArgTypes>
+    auto push(TaskPriority p, F &&f, ArgTypes && ... args)
+    {
+        TaskOptions o;
+        o.priority = p;
+        return push(o, std::forward<F>(f), std::forward<ArgTypes>(args)...);
+    }
+
+    /// returns nothing when executor queues are full
+    template <class F, class ... ArgTypes>
+    auto try_push(TaskOptions o, F &&f, ArgTypes && ... args)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        PackagedTask<F, ArgTypes...> pt(*this, std::move(f), std::forward<ArgTypes>(args)...);
+        std::optional fut = pt.getFuture();
+        if (!push(Task([pt = std::move(pt)]() { pt(); }), o, true))
+            fut.reset();
+        return fut;
+    }
+
+    template <class F, class ... ArgTypes>
+    auto try_push(F &&f, ArgTypes && ... args)
+    {
+        return try_push(TaskOptions{}, std::forward<F>(f), std::forward<ArgTypes>(args)...);
+    }
+
+    /// run the task when the time comes, the result may be cancelled before that
+    template <class Clock, class Duration, class F, class ... ArgTypes>
+    auto push_at(const std::chrono::time_point<Clock, Duration> &tp, TaskOptions o, F &&f, ArgTypes && ... args)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        using PT = PackagedTask<F, ArgTypes...>;
+        PT pt(*this, std::move(f), std::forward<ArgTypes>(args)...);
+        DelayedFuture<typename PT::Ret> fut(pt.getFuture(), {});
+        auto n = std::make_shared<detail::TimerTask<PT>>(*this, o, std::move(pt));
+        fut.handle = TimerHandle(timers, n);
+        if constexpr (std::is_same_v<Clock, TimerWheel::Clock>)
+            timers.add(n, tp);
+        else
+            timers.add(n, TimerWheel::Clock::now() + std::chrono::duration_cast<TimerWheel::Clock::duration>(tp - Clock::now()));
+        return fut;
+    }
+
+    template <class Clock, class Duration, class F, class ... ArgTypes>
+    auto push_at(const std::chrono::time_point<Clock, Duration> &tp, F &&f, ArgTypes && ... args)
+    {
+        return push_at(tp, TaskOptions{}, std::forward<F>(f), std::forward<ArgTypes>(args)...);
+    }
+
+    template <class Rep, class Period, class F, class ... ArgTypes>
+    auto push_after(const std::chrono::duration<Rep, Period> &d, TaskOptions o, F &&f, ArgTypes && ... args)
+    {
+        return push_at(TimerWheel::Clock::now() + d, o, std::forward<F>(f), std::forward<ArgTypes>(args)...);
+    }
+
+    template <class Rep, class Period, class F, class ... ArgTypes>
+    auto push_after(const std::chrono::duration<Rep, Period> &d, F &&f, ArgTypes && ... args)
+    {
+        return push_at(TimerWheel::Clock::now() + d, TaskOptions{}, std::forward<F>(f), std::forward<ArgTypes>(args)...);
+    }
+
+    template <class F>
+    auto push(F &&f, size_t n_jobs)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        PackagedTask<F> pt(*this, std::move(f));
+        auto fut = pt.getFuture();
+        Task task([pt = std::move(pt)]() { pt(); });
+        if (n_jobs == 1)
+            task();
+        else
+            push(std::move(task));
+        return fut;
+    }
+
+    template <class F, class ... ArgTypes>
+    auto push(PackagedTask<F, ArgTypes...> pt)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        auto fut = pt.getFuture();
+        push(Task([pt = std::move(pt)]() { pt(); }));
+        return fut;
+    }
+
+    template <class F, class ... ArgTypes>
+    auto push(TaskOptions o, PackagedTask<F, ArgTypes...> pt)
+    {
+        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
+
+        auto fut = pt.getFuture();
+        push(Task([pt = std::move(pt)]() { pt(); }), o);
+        return fut;
+    }
+
+    /// push a bare task, nobody waits for its result
+    void push(Task &&t, TaskOptions o = {})
+    {
+        push(std::move(t), o, false);
+    }
+
+private:
+    // try_only - do not block or throw on full queues or waiting executor, return false instead
+    bool push(Task &&t, TaskOptions o, bool try_only)
+    {
+        if (try_only && waiting_ != WaitStatus::Running)
+            return false;
+        if (waiting_ == WaitStatus::RejectIncoming)
+            throw SW_RUNTIME_ERROR("Executor is in the wait state and rejects new jobs");
+        if (waiting_ == WaitStatus::BlockIncoming)
+        {
+            std::unique_lock<std::mutex> lk(m_wait);
+            cv_wait.wait(lk, [this] { return waiting_ == WaitStatus::Running; });
+        }
+
+        auto p = (size_t)o.priority;
+        if (p >= n_priorities)
+            throw SW_RUNTIME_ERROR("Bad task priority: " + std::to_string(p));
+
+        if (saturated())
+        {
+            if (try_only)
+                return false;
+            auto policy = overflow_policy.load();
+            if (policy == OverflowPolicy::Reject)
+                throw SW_RUNTIME_ERROR("Executor queues are full");
+            if (policy == OverflowPolicy::RunInCaller || is_in_executor())
+            {
+                t();
+                return true;
+            }
+            wait_for_space();
+        }
+
+        t.queued_at = now();
+
+        if (auto w = get_pinned_worker(o))
+        {
+            // nobody else can take it, so wake up the owner only
+            auto &thr = thread_pool[*w];
+            thr.pinned[p].push(std::move(t));
+            update_high_water(thr);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (thr.sleeping)
+                thr.n.notify();
+            return true;
+        }
+        if (auto w = get_numa_worker(o))
+        {
+            auto &thr = thread_pool[*w];
+            thr.node[p].push(std::move(t));
+            update_high_water(thr);
+            wake_node(*w);
+            return true;
+        }
+
+        // workers push into their own deques, no locks here
+        if (is_in_executor())
+        {
+            if (stopped_)
+                return true;
+            auto i = get_n();
+            if (o.priority == TaskPriority::Normal)
+                thread_pool[i].d.push(TaskBoxCache::get().get(std::move(t)));
+            else
+                thread_pool[i].q[p].push(std::move(t));
+            update_high_water(thread_pool[i]);
+            wake_one(i + 1);
+            return true;
+        }
+
+        auto i = index++;
+        for (size_t n = 0; n != nThreads; ++n)
+        {
+            auto j = (i + n) % nThreads;
+            if (thread_pool[j].q[p].try_push(std::move(t)))
+            {
+                update_high_water(thread_pool[j]);
+                wake(j);
+                return true;
+            }
+        }
+        thread_pool[i % nThreads].q[p].push(std::move(t));
+        update_high_water(thread_pool[i % nThreads]);
+        wake(i % nThreads);
+        return true;
     }
 
-    size_t numberOfThreads() const { return nThreads; }
+public:
+    /// limit number of queued tasks, 0 - unlimited
+    /// the limit is approximate, concurrent pushes may exceed it slightly
+    void set_capacity(size_t n, OverflowPolicy p = OverflowPolicy::Block)
+    {
+        overflow_policy = p;
+        capacity = n;
+        // let blocked producers recheck the new limit
+        space.notify_all();
+    }
 
-    template <class F, class ... ArgTypes>
-    auto push(F &&f, ArgTypes && ... args)
+    /// number of queued tasks, approximate
+    size_t size() const
     {
-        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
-
-        PackagedTask<F, ArgTypes...> pt(*this, f, std::forward<ArgTypes>(args)...);
-        return push(pt);
+        size_t n = 0;
+        for (auto &t : thread_pool)
+            n += t.size();
+        return n;
     }
 
-    template <class F>
-    auto push(F &&f, size_t n_jobs)
+    bool saturated() const
     {
-        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
-
-        PackagedTask<F> pt(*this, f);
-        auto fut = pt.getFuture();
-        Task task([pt]() { pt(); });
-        if (n_jobs == 1)
-            task();
-        else
-            push(std::move(task));
-        return fut;
+        auto c = capacity.load(std::memory_order_relaxed);
+        return c && size() >= c;
     }
 
-    template <class F, class ... ArgTypes>
-    auto push(PackagedTask<F, ArgTypes...> pt)
+    /// awaitable, resumes the coroutine on one of the workers
+    auto schedule(TaskOptions o = {})
     {
-        static_assert(!std::is_lvalue_reference<F>::value, "Argument cannot be an lvalue");
-
-        auto fut = pt.getFuture();
-        Task task([pt]() { pt(); });
-        push(std::move(task));
-        return fut;
+        struct awaiter
+        {
+            Executor &e;
+            TaskOptions o;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { e.push(Task([h] { h.resume(); }), o); }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{ *this, o };
     }
 
     // wait & terminate all workers
@@ -426,6 +1600,10 @@ public:
     {
         wait();
         stop();
+        // no workers are started after stop
+        {
+            std::unique_lock<std::mutex> lk(m_elastic);
+        }
         for (auto &t : thread_pool)
         {
             if (t.t.joinable())
@@ -434,9 +1612,23 @@ public:
     }
     void stop()
     {
+        // pending timers are cancelled, fired ones are still accepted
+        timers.stop();
         stopped_ = true;
         for (auto &t : thread_pool)
-            t.q.done();
+        {
+            for (size_t p = 0; p != n_priorities; ++p)
+            {
+                t.q[p].done();
+                t.pinned[p].done();
+                t.node[p].done();
+            }
+            t.n.notify();
+        }
+        space.notify_all();
+        std::unique_lock<std::mutex> lk(m_waiters);
+        for (auto n : waiters)
+            n->notify();
     }
     void wait(WaitStatus p = WaitStatus::BlockIncoming)
     {
@@ -454,17 +1646,12 @@ public:
         // wait for empty queues
         for (auto &t : thread_pool)
         {
-            while (!t.q.empty() && !stopped_)
+            while (!t.empty() && !stopped_)
             {
                 if (run_again)
                 {
                     // finish everything
-                    for (auto &tt : thread_pool)
-                    {
-                        Task ta;
-                        if (tt.q.try_pop(ta, thread_pool[get_n()].busy))
-                            run_task(get_n(), ta);
-                    }
+                    try_run_one();
                 }
                 else
                     std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -489,10 +1676,21 @@ public:
 
     bool is_in_executor() const
     {
-        return thread_ids.find(std::this_thread::get_id()) != thread_ids.end();
+        return current_executor == this;
     }
+    /// run one queued task in the calling thread
+    /// threads outside of the executor only steal, worker deques are popped by their owners
     bool try_run_one()
     {
+        if (!is_in_executor())
+        {
+            auto t = try_steal();
+            if (!t)
+                return false;
+            notify_space();
+            t();
+            return true;
+        }
         auto t = try_pop();
         if (t)
             run_task(t);
@@ -506,18 +1704,130 @@ public:
         });
     }
 
+    ExecutorMetrics metrics() const
+    {
+        ExecutorMetrics m;
+        for (auto &t : thread_pool)
+        {
+            auto &w = m.workers.emplace_back();
+            w.tasks_executed = t.tasks_executed.load(std::memory_order_relaxed);
+            w.steals = t.steals.load(std::memory_order_relaxed);
+            w.failed_steals = t.failed_steals.load(std::memory_order_relaxed);
+            w.busy_ns = t.busy_ns.load(std::memory_order_relaxed);
+            w.idle_ns = t.idle_ns.load(std::memory_order_relaxed);
+            w.queue_high_water = t.queue_high_water.load(std::memory_order_relaxed);
+            w.queue_wait_ns = t.queue_wait.get();
+            w.run_time_ns = t.run_time.get();
+        }
+        return m;
+    }
+
+    /// notifier of the current thread: own worker's one or a thread local one
+    Notifier &get_notifier()
+    {
+        if (is_in_executor())
+            return thread_pool[get_n()].n;
+        static thread_local Notifier n;
+        return n;
+    }
+
+    /// block until ready() returns true or executor is stopped
+    /// n must be registered somewhere where ready() condition is changed
+    /// inside executor we continue to run other tasks
+    template <class F>
+    void wait_until(Notifier &n, F &&ready)
+    {
+        if (!is_in_executor())
+        {
+            add_waiter(n);
+            while (!ready() && !stopped_)
+            {
+                auto ticket = n.prepare();
+                if (ready() || stopped_)
+                    break;
+                n.wait(ticket);
+            }
+            remove_waiter(n);
+            return;
+        }
+
+        // continue executor business
+        auto &thr = thread_pool[get_n()];
+        while (!ready() && !stopped_)
+        {
+            if (try_run_one())
+                continue;
+            auto ticket = n.prepare();
+            start_sleep(thr);
+            if (!ready() && empty() && !stopped_)
+                n.wait(ticket);
+            stop_sleep(thr);
+        }
+    }
+
 private:
     Threads thread_pool;
     size_t nThreads = std::thread::hardware_concurrency();
+    size_t max_threads;
+    std::string name;
+    bool pin_threads;
+    // elastic mode
+    // slots up to n_slots may be active, scans of worker queues go up to it
+    std::atomic_size_t n_slots{ 0 };
+    std::atomic_size_t n_running{ 0 };
+    std::atomic_size_t n_blocking{ 0 };
+    std::atomic<std::chrono::milliseconds> idle_timeout{ std::chrono::seconds(10) };
+    std::mutex m_elastic;
     std::atomic_size_t index{ 0 };
     std::atomic_bool stopped_{ false };
     std::mutex m_wait;
     std::condition_variable cv_wait;
     std::atomic<WaitStatus> waiting_{ WaitStatus::Running };
-    std::unordered_map<std::thread::id, size_t> thread_ids;
+    std::atomic_size_t n_sleeping{ 0 };
     std::mutex m;
+    // external threads waiting for our futures, woken on stop()
+    std::vector<Notifier *> waiters;
+    std::mutex m_waiters;
+    // bounded queues
+    std::atomic_size_t capacity{ 0 };
+    std::atomic<OverflowPolicy> overflow_policy{ OverflowPolicy::Block };
+    std::atomic_size_t n_blocked{ 0 };
+    Notifier space;
+    TimerWheel timers;
+
+    // worker thread identity, set once on thread start
+    static inline thread_local Executor *current_executor = nullptr;
+    static inline thread_local size_t current_thread = 0;
+    // nested tasks run while waiting are not counted as busy time twice
+    static inline thread_local int run_depth = 0;
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // single writer counters
+    static void add(std::atomic_uint64_t &c, uint64_t v)
+    {
+        c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    static void update_high_water(Thread &thr)
+    {
+        auto n = (uint64_t)thr.size();
+        auto old = thr.queue_high_water.load(std::memory_order_relaxed);
+        while (n > old && !thr.queue_high_water.compare_exchange_weak(old, n, std::memory_order_relaxed))
+            ;
+    }
 
-    void run(size_t i, const std::string &name)
+    void init_worker(size_t i)
+    {
+        if (pin_threads)
+            pin(i);
+        current_executor = this;
+        current_thread = i;
+        if (elastic())
+            primitives::setBlockingRegionHandler(this);
+    }
+    void run(size_t i)
     {
         auto n = name;
         if (!n.empty())
@@ -545,7 +1855,7 @@ private:
         auto t = get_task(i);
 
         // double check
-        if (stopped_)
+        if (stopped_ || !t)
             return false;
 
         run_task(i, t);
@@ -556,12 +1866,34 @@ private:
         primitives::ScopedThreadName stn(std::to_string(i) + " busy");
 
         auto &thr = thread_pool[i];
+        notify_space();
+        auto start = now();
+        if (t.queued_at)
+            thr.queue_wait.add(std::max<int64_t>(0, start - t.queued_at));
+        ++run_depth;
         t();
+        --run_depth;
+        auto d = now() - start;
+        thr.run_time.add(d);
+        add(thr.tasks_executed, 1);
+        if (!run_depth)
+            add(thr.busy_ns, d);
         thr.busy = false;
     }
+    // task was taken from a bounded queue
+    void notify_space()
+    {
+        if (capacity.load(std::memory_order_relaxed))
+        {
+            // producers either see the freed space or we see them blocked
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (n_blocked)
+                space.notify();
+        }
+    }
     size_t get_n() const
     {
-        return thread_ids.find(std::this_thread::get_id())->second;
+        return current_thread;
     }
     Task get_task()
     {
@@ -570,12 +1902,181 @@ private:
     Task get_task(size_t i)
     {
         auto &thr = thread_pool[i];
-        Task t = try_pop(i);
-        // no task popped, probably shutdown command was issues
-        if (!t && !thr.q.pop(t, thr.busy))
-            return Task();
-
-        return t;
+        while (!stopped_)
+        {
+            Task t = try_pop(i);
+            if (t)
+                return t;
+
+            // announce that we are going to sleep, then check again,
+            // so pushers either see us sleeping or we see their tasks
+            auto ticket = thr.n.prepare();
+            start_sleep(thr);
+            bool retire = false;
+            if (empty() && !stopped_)
+            {
+                auto start = now();
+                if (i < nThreads)
+                    thr.n.wait(ticket);
+                else
+                    retire = !thr.n.wait_for(ticket, idle_timeout.load()) && try_retire(thr);
+                add(thr.idle_ns, now() - start);
+            }
+            stop_sleep(thr);
+            if (retire)
+                break;
+        }
+        return Task();
+    }
+    std::optional<size_t> get_pinned_worker(const TaskOptions &o)
+    {
+        if (o.worker)
+        {
+            if (*o.worker >= nThreads)
+                throw SW_RUNTIME_ERROR("Bad worker: " + std::to_string(*o.worker));
+            return o.worker;
+        }
+        return {};
+    }
+    std::optional<size_t> get_numa_worker(const TaskOptions &o)
+    {
+        if (!o.numa_node)
+            return {};
+        // round-robin over workers of the node
+        auto i = index++;
+        for (size_t n = 0; n != nThreads; ++n)
+        {
+            auto j = (i + n) % nThreads;
+            if (thread_pool[j].numa_node == *o.numa_node)
+                return j;
+        }
+        return {};
+    }
+    // best effort, worker stays unpinned on failure
+    void pin(size_t i)
+    {
+        auto &thr = thread_pool[i];
+#ifdef _WIN32
+        DWORD_PTR process_mask, system_mask;
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || !process_mask)
+            return;
+        std::vector<int> cpus;
+        for (int c = 0; c < (int)sizeof(process_mask) * 8; c++)
+        {
+            if (process_mask & ((DWORD_PTR)1 << c))
+                cpus.push_back(c);
+        }
+        auto cpu = cpus[i % cpus.size()];
+        if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu))
+            return;
+        thr.cpu = cpu;
+        UCHAR node;
+        if (GetNumaProcessorNode((UCHAR)cpu, &node))
+            thr.numa_node = node;
+#elif defined(__linux__)
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return;
+        std::vector<int> cpus;
+        for (int c = 0; c < CPU_SETSIZE; c++)
+        {
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+        }
+        if (cpus.empty())
+            return;
+        auto cpu = cpus[i % cpus.size()];
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            return;
+        thr.cpu = cpu;
+        unsigned c, node;
+        if (getcpu(&c, &node) == 0)
+            thr.numa_node = node;
+#endif
+    }
+    bool elastic() const
+    {
+        return max_threads > nThreads;
+    }
+    void beginBlockingRegion() override
+    {
+        if (++n_blocking >= n_running)
+            grow();
+    }
+    void endBlockingRegion() override
+    {
+        --n_blocking;
+    }
+    // start an extra worker if every running worker is blocked
+    void grow()
+    {
+        std::unique_lock<std::mutex> lk(m_elastic);
+        if (stopped_ || n_blocking < n_running)
+            return;
+        for (size_t i = nThreads; i < thread_pool.size(); ++i)
+        {
+            auto &thr = thread_pool[i];
+            if (thr.active)
+                continue;
+            // retired one
+            if (thr.t.joinable())
+                thr.t.join();
+            thr.active = true;
+            ++n_running;
+            if (n_slots < i + 1)
+                n_slots = i + 1;
+            thr.t = make_thread([this, i]
+            {
+                init_worker(i);
+                run(i);
+            });
+            return;
+        }
+    }
+    // idle extra worker stops if somebody else is still able to run tasks
+    bool try_retire(Thread &thr)
+    {
+        std::unique_lock<std::mutex> lk(m_elastic);
+        if (!thr.empty() || n_running <= n_blocking + 1)
+            return false;
+        thr.active = false;
+        --n_running;
+        return true;
+    }
+    void wait_for_space()
+    {
+        ++n_blocked;
+        while (saturated() && !stopped_)
+        {
+            auto ticket = space.prepare();
+            if (!saturated() || stopped_)
+                break;
+            space.wait(ticket);
+        }
+        --n_blocked;
+    }
+    void start_sleep(Thread &thr)
+    {
+        thr.sleeping = true;
+        ++n_sleeping;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    void stop_sleep(Thread &thr)
+    {
+        thr.sleeping = false;
+        --n_sleeping;
+    }
+    void add_waiter(Notifier &n)
+    {
+        std::unique_lock<std::mutex> lk(m_waiters);
+        waiters.push_back(&n);
+    }
+    void remove_waiter(Notifier &n)
+    {
+        std::unique_lock<std::mutex> lk(m_waiters);
+        std::erase(waiters, &n);
     }
     Task get_task_non_stealing()
     {
@@ -585,28 +2086,58 @@ private:
     {
         auto &thr = thread_pool[i];
         Task t;
-        if (thr.q.pop(t, thr.busy))
-            return t;
-        return Task();
+        for (size_t p = 0; p != n_priorities; ++p)
+        {
+            if (thr.pinned[p].try_pop(t, thr.busy) || thr.node[p].try_pop(t, thr.busy) || thr.q[p].try_pop(t, thr.busy))
+                break;
+        }
+        return t;
     }
 
-    void push(Task &&t)
+    // wake up the owner of the queue or any other sleeping worker to steal the task
+    void wake(size_t i)
     {
-        if (waiting_ == WaitStatus::RejectIncoming)
-            throw SW_RUNTIME_ERROR("Executor is in the wait state and rejects new jobs");
-        if (waiting_ == WaitStatus::BlockIncoming)
+        // elastic executor starts a worker when all are blocked
+        if (elastic() && n_blocking >= n_running)
+            grow();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (thread_pool[i].sleeping)
+            thread_pool[i].n.notify();
+        else
+            wake_one(i + 1);
+    }
+    // wake up a sleeping worker of the numa node of worker i, starting from it
+    void wake_node(size_t i)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_sleeping == 0)
+            return;
+        for (size_t n = 0; n != nThreads; ++n)
         {
-            std::unique_lock<std::mutex> lk(m_wait);
-            cv_wait.wait(lk, [this] { return waiting_ == WaitStatus::Running; });
+            auto &thr = thread_pool[(i + n) % nThreads];
+            if (thr.numa_node == thread_pool[i].numa_node && thr.sleeping)
+            {
+                thr.n.notify();
+                return;
+            }
         }
-
-        auto i = index++;
-        for (size_t n = 0; n != nThreads; ++n)
+    }
+    // wake up one sleeping worker (if any) so it can steal new work
+    void wake_one(size_t from)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_sleeping == 0)
+            return;
+        auto slots = n_slots.load();
+        for (size_t n = 0; n != slots; ++n)
         {
-            if (thread_pool[(i + n) % nThreads].q.try_push(std::move(t)))
+            auto &thr = thread_pool[(from + n) % slots];
+            if (thr.sleeping)
+            {
+                thr.n.notify();
                 return;
+            }
         }
-        thread_pool[i % nThreads].q.push(std::move(t));
     }
     Task try_pop()
     {
@@ -615,11 +2146,80 @@ private:
     Task try_pop(size_t i)
     {
         Task t;
-        const size_t spin_count = nThreads * 4;
-        for (auto n = 0; n != spin_count; ++n)
+        TaskBox *p;
+        auto &thr = thread_pool[i];
+
+        // we mark ourselves busy before taking a task, so wait() won't miss it
+        bool was_busy = thr.busy.exchange(true);
+
+        // higher priorities first, all queues of one priority are checked before the next one
+        for (size_t pr = 0; pr != n_priorities; ++pr)
         {
-            if (thread_pool[(i + n) % nThreads].q.try_pop(t, thread_pool[i].busy))
-                break;
+            bool normal = pr == (size_t)TaskPriority::Normal;
+
+            if (thr.pinned[pr].try_pop(t, thr.busy))
+                return t;
+            if (try_pop_node(i, pr, t))
+                return t;
+
+            // own deque first, latest tasks are hot in cache
+            if (normal && thr.d.pop(p))
+                return TaskBoxCache::get().put(p);
+
+            // own queue, then steal from others
+            auto slots = n_slots.load();
+            for (size_t n = 0; n != slots; ++n)
+            {
+                auto &victim = thread_pool[(i + n) % slots];
+                if (normal && n && !victim.d.empty())
+                {
+                    if (victim.d.steal(p))
+                    {
+                        add(thr.steals, 1);
+                        return TaskBoxCache::get().put(p);
+                    }
+                    add(thr.failed_steals, 1);
+                }
+                if (victim.q[pr].try_pop(t, thr.busy))
+                    return t;
+            }
+        }
+
+        thr.busy = was_busy;
+        return t;
+    }
+    // tasks of the own numa node, own queue first
+    bool try_pop_node(size_t i, size_t pr, Task &t)
+    {
+        auto &thr = thread_pool[i];
+        if (thr.numa_node == -1)
+            return false;
+        for (size_t n = 0; n != nThreads; ++n)
+        {
+            auto &w = thread_pool[(i + n) % nThreads];
+            if (w.numa_node == thr.numa_node && w.node[pr].try_pop(t, thr.busy))
+                return true;
+        }
+        return false;
+    }
+    // for threads outside of the executor: pinned and numa queues and owner ends of deques are not touched
+    Task try_steal()
+    {
+        Task t;
+        TaskBox *p;
+        std::atomic_bool busy;
+        for (size_t pr = 0; pr != n_priorities; ++pr)
+        {
+            bool normal = pr == (size_t)TaskPriority::Normal;
+            auto slots = n_slots.load();
+            for (size_t n = 0; n != slots; ++n)
+            {
+                auto &victim = thread_pool[n];
+                if (normal && !victim.d.empty() && victim.d.steal(p))
+                    return TaskBoxCache::get().put(p);
+                if (victim.q[pr].try_pop(t, busy))
+                    return t;
+            }
         }
         return t;
     }
@@ -629,56 +2229,150 @@ private:
 template <class T>
 void SharedState<T>::wait()
 {
-    using namespace std::literals::chrono_literals;
-
     if (set)
         return;
 
-    if (!e.is_in_executor())
+    // notifier is woken by setExecuted(), by new tasks for our worker or by executor stop
+    auto &n = e.get_notifier();
+    if (!add_notifier(n))
+        return;
+    e.wait_until(n, [this] { return set.load(); });
+    remove_notifier(n);
+}
+
+namespace detail
+{
+
+template <class PT>
+struct TimerTask : TimerNode
+{
+    Executor &e;
+    TaskOptions o;
+    PT pt;
+
+    TimerTask(Executor &e, TaskOptions o, PT pt)
+        : e(e), o(o), pt(std::move(pt))
+    {
+    }
+
+    void fire() override
+    {
+        // keep pt, so a rejected task can still be cancelled
+        e.push(o, pt);
+    }
+
+    void cancel() noexcept override
+    {
+        pt.cancel(std::make_exception_ptr(SW_RUNTIME_ERROR("Task was cancelled")));
+    }
+};
+
+}
+
+template <class Ret>
+template <class F2, class ... ArgTypes2>
+Future<std::invoke_result_t<F2, ArgTypes2...>>
+Future<Ret>::then(F2 &&f, ArgTypes2 && ... args)
+{
+    if (state->set)
+        return state->e.push(std::forward<F2>(f), std::forward<ArgTypes2>(args)...);
+
+    // callback may outlive this future object, so capture only the executor
+    auto &e = state->e;
+    PackagedTask<F2, ArgTypes2...> pt(e, std::forward<F2>(f), std::forward<ArgTypes2>(args)...);
+    auto fut = pt.getFuture();
+    if (!state->add_callback([&e, pt]() { e.push(pt); }))
+        e.push(std::move(pt));
+    return fut;
+}
+
+namespace detail
+{
+
+/// Shared state of whenAll/whenAny together with a continuation node for every input,
+/// so joining any number of futures takes one group allocation and no locks.
+template <class Ret>
+struct WhenState : SharedState<Ret>
+{
+    struct Node : Continuation
+    {
+        WhenState *g = nullptr;
+    };
+
+    std::vector<Node> nodes;
+    // nodes still linked to inputs
+    std::atomic_size_t pending;
+    // an input was destroyed without being set
+    std::atomic_bool cancelled{ false };
+    // whenAny result is taken
+    std::atomic_bool won{ false };
+    bool all;
+    // keeps the group alive while inputs refer to its nodes
+    SharedStatePtr<Ret> self;
+
+    WhenState(Executor &e, size_t n, bool all)
+        : SharedState<Ret>(e), nodes(n), pending(n), all(all)
+    {
+    }
+
+    static void fire(Continuation *c, bool set)
     {
-        // there is a deadlock somewhere related to this
-        // so we workaround with wait_for()
-        const auto max_delay = 1s;
-        auto delay = 100ms;
-        while (!set && !e.stopped())
+        auto n = static_cast<Node *>(c);
+        auto g = n->g;
+        if (!set)
+            g->cancelled = true;
+        else if constexpr (!std::is_same_v<Ret, void>)
+        {
+            // the first one wins, result is written before the state is set
+            if (!g->all && !g->set)
+            {
+                bool won = false;
+                if (g->won.compare_exchange_strong(won, true))
+                {
+                    g->data = n - g->nodes.data();
+                    g->setExecuted();
+                }
+            }
+        }
+        if (--g->pending == 0)
         {
-            std::unique_lock<std::mutex> lk(m);
-            cv.wait_for(lk, delay, [this] { return set.load(); });
-            delay = delay > max_delay ? max_delay : (delay + 100ms);
+            if (g->all && !g->cancelled)
+                g->setExecuted();
+            // may destroy the group
+            auto self = std::move(g->self);
         }
-        return;
     }
 
-    // continue executor business
-    const auto max_delay = 1s;
-    auto delay = 100ms;
-    while (!set && !e.stopped())
-    {
-        if (!e.try_run_one())
+    template <class F>
+    static SharedStatePtr<Ret> make(Executor &e, size_t n, bool all, F &&for_each_state)
+    {
+        auto g = std::make_shared<WhenState>(e, n, all);
+        g->w = g;
+        g->self = g;
+        auto gp = g.get();
+        size_t i = 0;
+        for_each_state([gp, &i](auto &state)
         {
-            std::unique_lock<std::mutex> lk(m);
-            cv.wait_for(lk, delay, [this] { return set.load(); });
-            delay = delay > max_delay ? max_delay : (delay + 100ms);
-        }
-        else
-            delay = 100ms;
+            auto &node = gp->nodes[i++];
+            node.g = gp;
+            node.fn = &WhenState::fire;
+            if (!state.add_continuation(node))
+                fire(&node, true);
+        });
+        return g;
     }
-}
+};
 
-template <class Ret>
-template <class F2, class ... ArgTypes2>
-Future<std::invoke_result_t<F2, ArgTypes2...>>
-Future<Ret>::then(F2 &&f, ArgTypes2 && ... args)
+template <class Ret, class ... Args>
+SharedStatePtr<Ret> makeSetSharedState(Executor &e, Args && ... v)
 {
-    if (state->set)
-        return state->e.push(std::forward<F2>(f), std::forward<ArgTypes2>(args)...);
+    auto s = makeSharedState<Ret>(e);
+    if constexpr (sizeof...(Args) != 0)
+        s->data = Ret(std::forward<Args>(v)...);
+    s->set = true;
+    return s;
+}
 
-    std::unique_lock<std::mutex> lk(state->m);
-    if (state->set)
-        return state->e.push(std::forward<F2>(f), std::forward<ArgTypes2>(args)...);
-    PackagedTask<F2, ArgTypes2...> pt(state->e, f, std::forward<ArgTypes2>(args)...);
-    state->callbacks.push_back([this, pt]() { state->e.push(pt); });
-    return pt.getFuture();
 }
 
 // vector versions
@@ -687,56 +2381,17 @@ Future<void> whenAll(auto &&executor, const Futures<F> &futures)
 {
     using Ret = void;
 
-    SharedStatePtr<Ret> s;
-    if (futures.empty())
-    {
-        s = makeSharedState<Ret>(executor);
-        s->set = true;
-    }
-    else
-        s = makeSharedState<Ret>(futures.begin()->state->e);
-
-    // initial check
     if (std::all_of(futures.begin(), futures.end(),
         [](const auto &f) { return f.state->set.load(); }))
     {
-        s->set = true;
-        return s->getFuture();
-    }
-
-    // lock
-    for (auto &f : futures)
-        f.state->m.lock();
-
-    auto unlock = [&futures]()
-    {
-        for (auto &f : futures)
-            f.state->m.unlock();
-    };
-
-    // second check
-    if (std::all_of(futures.begin(), futures.end(),
-        [](auto &f) { return f.state->set.load(); }))
-    {
-        s->set = true;
-        unlock();
-        return s->getFuture();
+        return detail::makeSetSharedState<Ret>(futures.empty() ? executor : futures.begin()->state->e)->getFuture();
     }
 
-    // set cb
-    auto ac = std::make_shared<std::atomic_size_t>();
-    for (auto &f : futures)
+    return detail::WhenState<Ret>::make(futures.begin()->state->e, futures.size(), true, [&futures](auto &&f)
     {
-        f.state->callbacks.push_back([s, max = futures.size() - 1, ac]
-        {
-            if ((*ac)++ == max)
-            s->setExecuted();
-        });
-    }
-
-    unlock();
-
-    return s->getFuture();
+        for (auto &fut : futures)
+            f(*fut.state);
+    })->getFuture();
 }
 
 /// return a future with an index of the finished future
@@ -745,72 +2400,32 @@ Future<size_t> whenAny(auto &&executor, const Futures<F> &futures)
 {
     using Ret = size_t;
 
-    SharedStatePtr<Ret> s;
     if (futures.empty())
-    {
-        s = makeSharedState<Ret>(executor);
-        s->set = true;
-    }
-    else
-        s = makeSharedState<Ret>(futures.begin()->state->e);
-
-    // initial check
-    size_t i = 0;
-    for (auto &f : futures)
-    {
-        if (f.state->set)
-        {
-            s->data = i;
-            s->set = true;
-            return s->getFuture();
-        }
-        i++;
-    }
+        return detail::makeSetSharedState<Ret>(executor)->getFuture();
 
-    // lock
-    for (auto &f : futures)
-        f.state->m.lock();
-
-    auto unlock = [&futures]()
-    {
-        for (auto &f : futures)
-            f.state->m.unlock();
-    };
+    auto it = std::find_if(futures.begin(), futures.end(), [](const auto &f) { return f.state->set.load(); });
+    if (it != futures.end())
+        return detail::makeSetSharedState<Ret>(futures.begin()->state->e, (size_t)(it - futures.begin()))->getFuture();
 
-    // second check
-    i = 0;
-    for (auto &f : futures)
+    return detail::WhenState<Ret>::make(futures.begin()->state->e, futures.size(), false, [&futures](auto &&f)
     {
-        if (f.state->set)
-        {
-            s->data = i;
-            s->set = true;
-            unlock();
-            return s->getFuture();
-        }
-        i++;
-    }
-
-    // set cb
-    i = 0;
-    for (auto &f : futures)
-        f.state->callbacks.push_back([s, i = i++]{ if (s->setExecuted()) s->data = i; });
-
-    unlock();
-
-    return s->getFuture();
+        for (auto &fut : futures)
+            f(*fut.state);
+    })->getFuture();
 }
 
 template <class F>
 void waitAll(const Futures<F> &futures)
 {
-    whenAll(futures).get();
+    for (auto &f : futures)
+        f.wait();
 }
 
 template <class F>
 void waitAny(const Futures<F> &futures)
 {
-    whenAny(futures).get();
+    if (!futures.empty())
+        whenAny(futures.begin()->state->e, futures).get();
 }
 
 template <class F>
@@ -862,150 +2477,402 @@ Future<void> whenAll(auto &&executor, Futures && ... futures)
     auto t = std::make_tuple(std::forward<Futures>(futures)...);
     constexpr auto sz = sizeof...(futures);
 
-    SharedStatePtr<Ret> s;
-    if (sz == 0)
+    if constexpr (sz == 0)
+        return detail::makeSetSharedState<Ret>(executor)->getFuture();
+    else
     {
-        s = makeSharedState<Ret>(executor);
-        s->set = true;
+        bool set = true;
+        for_each(t, [&set](const auto &f) { set &= f.state->set.load(); });
+        if (set)
+            return detail::makeSetSharedState<Ret>(std::get<0>(t).state->e)->getFuture();
+
+        return detail::WhenState<Ret>::make(std::get<0>(t).state->e, sz, true, [&t](auto &&f)
+        {
+            for_each(t, [&f](auto &fut) { f(*fut.state); });
+        })->getFuture();
     }
+}
+
+/// return a future with an index of the finished future
+template <
+    class ... Futures,
+    typename = std::enable_if_t<
+    all< is_future< std::decay_t<Futures> >::value... >::value
+    >
+>
+Future<size_t> whenAny(auto &&executor, Futures && ... futures)
+{
+    using Ret = size_t;
+
+    auto t = std::make_tuple(std::forward<Futures>(futures)...);
+    constexpr auto sz = sizeof...(futures);
+
+    if constexpr (sz == 0)
+        return detail::makeSetSharedState<Ret>(executor)->getFuture();
     else
-        s = makeSharedState<Ret>(std::get<0>(t).state->e);
+    {
+        size_t i = 0;
+        size_t n = -1;
+        for_each(t, [&i, &n](const auto &f)
+        {
+            if (n == -1 && f.state->set)
+                n = i;
+            i++;
+        });
+        if (n != -1)
+            return detail::makeSetSharedState<Ret>(std::get<0>(t).state->e, n)->getFuture();
 
-    // initial check
-    bool set = true;
-    for_each(t, [&set](const auto &f) { set &= f.state->set.load(); });
-    if (set)
+        return detail::WhenState<Ret>::make(std::get<0>(t).state->e, sz, false, [&t](auto &&f)
+        {
+            for_each(t, [&f](auto &fut) { f(*fut.state); });
+        })->getFuture();
+    }
+}
+
+template <class ... Futures>
+void waitAll(Futures && ... futures)
+{
+    whenAll(std::forward<Futures>(futures)...).get();
+}
+
+template <class ... Futures>
+void waitAny(Futures && ... futures)
+{
+    whenAny(std::forward<Futures>(futures)...).get();
+}
+
+// parallel algorithms
+//
+// Ranges are split recursively in halves until grain size is reached.
+// The right half is pushed to the executor (into the worker's deque where idle workers can steal it),
+// the left half is processed in place. Waiting for pushed halves runs other tasks, so workers never block.
+
+namespace detail
+{
+
+inline size_t parallel_grain_size(Executor &e, size_t n, size_t grain)
+{
+    if (grain)
+        return grain;
+    // several chunks per thread is enough to balance uneven workloads
+    return std::max<size_t>(1, n / (e.numberOfThreads() * 8));
+}
+
+template <class It, class F>
+void parallel_for(Executor &e, It first, size_t n, size_t grain, F &f)
+{
+    if (n <= grain)
     {
-        s->set = true;
-        return s->getFuture();
+        for (size_t i = 0; i < n; ++i, ++first)
+            f(*first);
+        return;
     }
 
-    // lock
-    for_each(t, [](auto &f) { f.state->m.lock(); });
+    auto half = n / 2;
+    auto right = e.push([&e, first = first + half, n = n - half, grain, &f]
+    {
+        parallel_for(e, first, n, grain, f);
+    });
+    try
+    {
+        parallel_for(e, first, half, grain, f);
+    }
+    catch (...)
+    {
+        // right half references our stack, so it must be finished before we leave
+        right.wait();
+        throw;
+    }
+    right.get();
+}
 
-    auto unlock = [&t]()
+template <class T, class It, class Reduce, class Transform>
+T parallel_transform_reduce(Executor &e, It first, size_t n, size_t grain, Reduce &reduce, Transform &transform)
+{
+    if (n <= grain)
     {
-        for_each(t, [](auto &f) { f.state->m.unlock(); });
-    };
+        T acc = transform(*first);
+        for (size_t i = 1; i < n; ++i)
+            acc = reduce(std::move(acc), transform(*++first));
+        return acc;
+    }
 
-    // second check
-    set = true;
-    for_each(t, [&set](const auto &f) { set &= f.state->set.load(); });
-    if (set)
+    auto half = n / 2;
+    auto right = e.push([&e, first = first + half, n = n - half, grain, &reduce, &transform]
     {
-        s->set = true;
-        unlock();
-        return s->getFuture();
+        return parallel_transform_reduce<T>(e, first, n, grain, reduce, transform);
+    });
+    std::optional<T> left;
+    try
+    {
+        left = parallel_transform_reduce<T>(e, first, half, grain, reduce, transform);
+    }
+    catch (...)
+    {
+        right.wait();
+        throw;
     }
+    // keep order of arguments, so reduce must be associative only
+    return reduce(std::move(*left), right.get());
+}
 
-    // set cb
-    auto ac = std::make_shared<std::atomic_size_t>();
-    for_each(t, [&s, &ac
-#if defined(_MSC_VER) && !defined(__clang__)
-        , &sz
-#endif
-    ](auto &f)
+// run f inside executor, so all nested pushes go to worker deques
+template <class F>
+decltype(auto) run_in_executor(Executor &e, F &&f)
+{
+    if (e.is_in_executor())
+        return f();
+    return e.push([&f] { return f(); }).get();
+}
+
+}
+
+/// call f(v) for every element v of random access range r in parallel
+/// grain - max number of elements processed by one task, 0 - choose automatically
+template <class Range, class F>
+void parallel_for(Executor &e, Range &&r, size_t grain, F &&f)
+{
+    auto n = (size_t)std::ranges::size(r);
+    if (n == 0)
+        return;
+    grain = detail::parallel_grain_size(e, n, grain);
+    detail::run_in_executor(e, [&]
     {
-        f.state->callbacks.push_back([s, max = sz - 1, ac]
-        {
-            if ((*ac)++ == max)
-            s->setExecuted();
-        });
+        detail::parallel_for(e, std::ranges::begin(r), n, grain, f);
     });
+}
 
-    unlock();
+/// reduce(... reduce(reduce(init, transform(v0)), transform(v1)) ...) in parallel
+/// reduce must be associative, result is calculated in the range order
+template <class Range, class T, class Reduce, class Transform>
+T parallel_transform_reduce(Executor &e, Range &&r, size_t grain, T init, Reduce &&reduce, Transform &&transform)
+{
+    auto n = (size_t)std::ranges::size(r);
+    if (n == 0)
+        return init;
+    grain = detail::parallel_grain_size(e, n, grain);
+    return reduce(std::move(init), detail::run_in_executor(e, [&]
+    {
+        return detail::parallel_transform_reduce<T>(e, std::ranges::begin(r), n, grain, reduce, transform);
+    }));
+}
 
-    return s->getFuture();
+/// reduce(... reduce(reduce(init, v0), v1) ...) in parallel
+/// reduce must be associative, result is calculated in the range order
+template <class Range, class T, class Reduce>
+T parallel_reduce(Executor &e, Range &&r, size_t grain, T init, Reduce &&reduce)
+{
+    return parallel_transform_reduce(e, std::forward<Range>(r), grain, std::move(init), std::forward<Reduce>(reduce),
+        [](auto &&v) -> decltype(auto) { return std::forward<decltype(v)>(v); });
 }
 
-/// return a future with an index of the finished future
-template <
-    class ... Futures,
-    typename = std::enable_if_t<
-    all< is_future< std::decay_t<Futures> >::value... >::value
-    >
->
-Future<size_t> whenAny(auto &&executor, Futures && ... futures)
+/// awaiting a future suspends the coroutine without blocking the thread,
+/// it is resumed on the executor when the future is ready
+template <class T>
+auto operator co_await(Future<T> f)
 {
-    using Ret = size_t;
+    struct awaiter
+    {
+        Future<T> f;
 
-    auto t = std::make_tuple(std::forward<Futures>(futures)...);
-    //constexpr auto sz = sizeof...(futures);
+        bool await_ready() const noexcept { return f.state->set; }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            auto &e = f.state->e;
+            return f.state->add_callback([&e, h] { e.push(Task([h] { h.resume(); })); });
+        }
+        decltype(auto) await_resume() const { return f.get(); }
+    };
+    return awaiter{ std::move(f) };
+}
+
+namespace primitives::coro
+{
+
+template <class T = void>
+class Task;
 
-    SharedStatePtr<Ret> s;
-    if (sizeof...(futures) == 0)
+namespace detail
+{
+
+// symmetric transfer to the awaiter, so long chains do not grow the stack
+struct FinalAwaiter
+{
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
     {
-        s = makeSharedState<Ret>(executor);
-        s->set = true;
+        return h.promise().continuation;
     }
-    else
-        s = makeSharedState<Ret>(std::get<0>(t).state->e);
-
-    // initial check
-    size_t i = 0;
-    size_t n = -1;
-    bool set = false;
-    for_each(t, [&set, &i, &n](const auto &f)
-    {
-        set |= f.state->set.load();
-        if (set && n == -1)
-            n = i;
-        i++;
-    });
-    if (set)
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr eptr;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept
     {
-        s->data = n;
-        s->set = true;
-        return s->getFuture();
+        eptr = std::current_exception();
+    }
+
+    void rethrow() const
+    {
+        if (eptr)
+            std::rethrow_exception(eptr);
+    }
+};
+
+template <class T>
+struct Promise : PromiseBase
+{
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    template <class U = T>
+    void return_value(U &&v)
+    {
+        value.emplace(std::forward<U>(v));
     }
 
-    // lock
-    for_each(t, [](auto &f) { f.state->m.lock(); });
+    T result()
+    {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    Task<void> get_return_object();
+
+    void return_void() noexcept {}
+
+    void result() const
+    {
+        rethrow();
+    }
+};
 
-    auto unlock = [&t]()
+// fire and forget coroutine, frame is destroyed on completion
+struct Detached
+{
+    struct promise_type
     {
-        for_each(t, [](auto &f) { f.state->m.unlock(); });
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
     };
+};
+
+}
+
+/// Lazily started coroutine.
+/// Body runs when the task is awaited or passed to spawn().
+template <class T>
+class [[nodiscard]] Task
+{
+public:
+    using promise_type = detail::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
 
-    // second check
-    i = 0;
-    n = -1;
-    set = false;
-    for_each(t, [&set, &i, &n](const auto &f)
+    Task(Task &&rhs) noexcept
+        : h(std::exchange(rhs.h, {}))
     {
-        set |= f.state->set.load();
-        if (set && n == -1)
-            n = i;
-        i++;
-    });
-    if (set)
+    }
+    Task &operator=(Task &&rhs) noexcept
     {
-        s->data = n;
-        s->set = true;
-        unlock();
-        return s->getFuture();
+        if (this != &rhs)
+        {
+            if (h)
+                h.destroy();
+            h = std::exchange(rhs.h, {});
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (h)
+            h.destroy();
     }
 
-    // set cb
-    i = 0;
-    for_each(t, [&s, &i](auto &f)
+    auto operator co_await() const noexcept
     {
-        f.state->callbacks.push_back([s, i = i++]{ if (s->setExecuted()) s->data = i; });
-    });
+        struct awaiter
+        {
+            handle_type h;
 
-    unlock();
+            bool await_ready() const noexcept { return h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+            {
+                h.promise().continuation = c;
+                return h;
+            }
+            T await_resume() const { return h.promise().result(); }
+        };
+        return awaiter{ h };
+    }
 
-    return s->getFuture();
+private:
+    handle_type h;
+
+    explicit Task(handle_type h)
+        : h(h)
+    {
+    }
+
+    friend promise_type;
+};
+
+namespace detail
+{
+
+template <class T>
+Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
 }
 
-template <class ... Futures>
-void waitAll(Futures && ... futures)
+inline Task<void> Promise<void>::get_return_object()
 {
-    whenAll(std::forward<Futures>(futures)...).get();
+    return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
 }
 
-template <class ... Futures>
-void waitAny(Futures && ... futures)
+template <class T>
+Detached spawn(Executor &e, Task<T> t, SharedStatePtr<T> s)
 {
-    whenAny(std::forward<Futures>(futures)...).get();
+    co_await e.schedule();
+    try
+    {
+        if constexpr (std::is_same_v<T, void>)
+            co_await t;
+        else
+            s->data = co_await t;
+    }
+    catch (...)
+    {
+        s->eptr = std::current_exception();
+    }
+    s->setExecuted();
+}
+
+}
+
+/// start the task on the executor
+template <class T>
+Future<T> spawn(Executor &e, Task<T> t)
+{
+    auto s = makeSharedState<T>(e);
+    detail::spawn(e, std::move(t), s);
+    return s->getFuture();
+}
+
 }
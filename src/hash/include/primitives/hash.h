@@ -10,6 +10,11 @@
 #include <primitives/exceptions.h>
 
 #include <cstring>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+struct Executor;
 
 PRIMITIVES_HASH_API
 String generate_random_alnum_sequence(uint32_t len);
@@ -26,6 +31,15 @@ String bytes_to_string(const uint8_t *bytes, size_t size);
 PRIMITIVES_HASH_API
 String bytes_to_string(const String &bytes);
 
+/// Lowercase hex of in, out must have room for 2 * in.size() characters.
+PRIMITIVES_HASH_API
+void bytes_to_string(std::span<const uint8_t> in, std::span<char> out);
+
+/// Decode hex of any case, out must have room for in.size() / 2 bytes.
+/// Returns false on odd size or bad characters.
+PRIMITIVES_HASH_API
+bool string_to_bytes(std::string_view in, std::span<uint8_t> out);
+
 PRIMITIVES_HASH_API
 String md5(const String &data);
 
@@ -50,12 +64,32 @@ String sha3_256_file(const path &fn);
 PRIMITIVES_HASH_API
 String blake2b_512(const String &data);
 
+/// Fast non-cryptographic hash for change detection and dedup keys.
+/// Do not use it where collisions may be forced.
+PRIMITIVES_HASH_API
+uint64_t xxh3_64(const void *data, size_t size, uint64_t seed = 0);
+
+PRIMITIVES_HASH_API
+uint64_t xxh3_64(const String &data);
+
+PRIMITIVES_HASH_API
+uint64_t xxh3_64_file(const path &fn);
+
+/// hex string of 128 bit xxh3
+PRIMITIVES_HASH_API
+String xxh3_128(const String &data);
+
+PRIMITIVES_HASH_API
+String xxh3_128_file(const path &fn);
+
 enum class HashType
 {
     null            =   0,
     sha2_256        =   1,
     sha3_256        =   2,
     blake2b_512     =   3,
+    xxh3_64         =   4,
+    xxh3_128        =   5,
     max,
 };
 
@@ -89,6 +123,12 @@ String strong_file_hash_blake2b_sha3(const String &data);
 PRIMITIVES_HASH_API
 String strong_file_hash_file_blake2b_sha3(const path &fn);
 
+/// Hashes of many files computed on the executor, files are read in their disk order.
+/// type - first hash type of the strong hash: blake2b_512 (blake2b_sha3) or sha3_256 (sha3_sha2);
+/// xxh3_64 or xxh3_128 for hex strings of fast hashes
+PRIMITIVES_HASH_API
+std::unordered_map<path, String> hash_files(Executor &e, const FilesOrdered &files, HashType type = HashType::blake2b_512);
+
 PRIMITIVES_HASH_API
 String shorten_hash(const String &data, size_t size);
 
@@ -132,20 +172,9 @@ struct bytes : std::vector<std::byte> {
     }
 
     bytes(const std::string &v) {
-        auto sz = v.size();
-        resize(sz / 2);
-        if (sz % 2 != 0)
+        resize(v.size() / 2);
+        if (!string_to_bytes(v, {(uint8_t *)data(), size()}))
             throw SW_RUNTIME_ERROR("bad bytes string");
-        for (int i = 0; i < sz; i += 2) {
-            auto get_num = [](auto v) {
-                if (v > '9')
-                    return v - 'a' + 10;
-                return v - '0';
-            };
-            auto hi = get_num(v[i+0]) << 4;
-            auto lo = get_num(v[i+1]) << 0;
-            operator[](i / 2) = std::byte(hi | lo);
-        }
     }
     operator std::string() const { return bytes_to_string((const uint8_t*)data(), size()); }
 };
@@ -153,6 +182,59 @@ struct bytes : std::vector<std::byte> {
 PRIMITIVES_HASH_API
 bytes generate_strong_random_bytes(uint32_t len);
 
+struct uint128
+{
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    auto operator<=>(const uint128 &) const = default;
+};
+
+/// Streaming xxh3_64
+struct PRIMITIVES_HASH_API xxh3_64_stream
+{
+    xxh3_64_stream(uint64_t seed = 0);
+    xxh3_64_stream(const xxh3_64_stream &) = delete;
+    xxh3_64_stream &operator=(const xxh3_64_stream &) = delete;
+    ~xxh3_64_stream();
+
+    void reset(uint64_t seed = 0);
+    void update(const void *data, size_t size);
+    void update(const String &data) { update(data.data(), data.size()); }
+    uint64_t digest() const;
+
+private:
+    void *state;
+};
+
+/// Streaming xxh3_128
+struct PRIMITIVES_HASH_API xxh3_128_stream
+{
+    xxh3_128_stream(uint64_t seed = 0);
+    xxh3_128_stream(const xxh3_128_stream &) = delete;
+    xxh3_128_stream &operator=(const xxh3_128_stream &) = delete;
+    ~xxh3_128_stream();
+
+    void reset(uint64_t seed = 0);
+    void update(const void *data, size_t size);
+    void update(const String &data) { update(data.data(), data.size()); }
+    uint128 digest() const;
+
+private:
+    void *state;
+};
+
+/// Hash parameter of file storages
+struct xxh3_contents_hash
+{
+    using hash_type = uint64_t;
+
+    auto operator()(const path &fn) const
+    {
+        return xxh3_64_file(fn);
+    }
+};
+
 template <size_t sz, auto = []{}>
 struct bytes_strict : bytes {
     static_assert(sz > 0);
@@ -0,0 +1,94 @@
+// Copyright (C) 2026 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <primitives/hash.h>
+
+#include <map>
+
+namespace primitives::hash {
+
+/// Merkle tree of a file.
+/// Leaves are hashes of fixed size chunks, a node is the hash of its two children.
+/// Leaf and node data are prefixed with different bytes, the root also covers the file size and the chunk size.
+/// Digests are hex strings of sha2_256, sha3_256, blake2b_512 or xxh3_128.
+struct PRIMITIVES_HASH_API file_tree
+{
+    static constexpr uint64_t default_chunk_size = 1 << 20;
+
+    HashType type = HashType::xxh3_128;
+    uint64_t chunk_size = default_chunk_size;
+    uint64_t size = 0;
+    /// levels[0] are chunk hashes, levels.back() is the single top node
+    std::vector<std::vector<String>> levels;
+
+    file_tree() = default;
+    file_tree(const path &fn, HashType type = HashType::xxh3_128, uint64_t chunk_size = default_chunk_size);
+
+    const String &root() const;
+    size_t chunks() const { return levels.empty() ? 0 : levels[0].size(); }
+
+    /// Re-hash chunks intersecting [offset, offset + count) and the tail if the file size has changed.
+    /// Only O(changed chunks * log(chunks)) nodes are recalculated.
+    void update(const path &fn, uint64_t offset, uint64_t count);
+
+    /// Indices of differing chunks. Equal subtrees are skipped.
+    std::vector<size_t> diff(const file_tree &) const;
+
+    void save(const path &manifest) const;
+    static file_tree load(const path &manifest);
+
+private:
+    String root_hash;
+
+    void rebuild(std::vector<size_t> dirty);
+};
+
+/// Merkle tree of a directory.
+/// Files are checked by size and modification time, so update() reads only changed files.
+/// A directory hash is the hash of its sorted children names and hashes.
+struct PRIMITIVES_HASH_API dir_tree
+{
+    struct file
+    {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        /// root of the file_tree
+        String hash;
+
+        bool operator==(const file &) const = default;
+    };
+
+    path dir;
+    HashType type = HashType::xxh3_128;
+    uint64_t chunk_size = file_tree::default_chunk_size;
+    /// relative paths
+    std::map<path, file> files;
+    /// relative paths, "" is the root directory
+    std::map<path, String> dirs;
+
+    dir_tree() = default;
+    dir_tree(const path &dir, HashType type = HashType::xxh3_128, uint64_t chunk_size = file_tree::default_chunk_size);
+
+    const String &root() const;
+
+    /// Rescan the directory, re-hash new and modified files.
+    /// Returns changed, added and removed files.
+    FilesSorted update();
+
+    /// Files that differ between trees (by relative path).
+    FilesSorted diff(const dir_tree &) const;
+
+    void save(const path &manifest) const;
+    /// dir - directory the manifest describes
+    static dir_tree load(const path &manifest, const path &dir);
+
+private:
+    void rebuild();
+};
+
+}
@@ -6,14 +6,27 @@
 
 #include <primitives/hash.h>
 
-#include <primitives/file_iterator.h>
+#include <primitives/executor.h>
 
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <rhash.h>
+#include <xxhash.h>
 
+#include <algorithm>
+#include <array>
 #include <random>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 // keep always digits,lowercase,uppercase
 static const char alnum[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
@@ -58,6 +71,177 @@ String generate_strong_random_bytes(uint32_t len)
     return primitives::hash::generate_strong_random_bytes(len);
 }
 
+namespace
+{
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PRIMITIVES_HASH_SSE2
+#endif
+
+// "00".."ff"
+constexpr auto hex_pairs = []
+{
+    std::array<char, 512> t{};
+    for (int i = 0; i < 256; i++)
+    {
+        t[i * 2 + 0] = "0123456789abcdef"[i >> 4];
+        t[i * 2 + 1] = "0123456789abcdef"[i & 0xF];
+    }
+    return t;
+}();
+
+// -1 for non hex characters
+constexpr auto hex_values = []
+{
+    std::array<int8_t, 256> t{};
+    for (int i = 0; i < 256; i++)
+    {
+        if (i >= '0' && i <= '9')
+            t[i] = i - '0';
+        else if (i >= 'a' && i <= 'f')
+            t[i] = i - 'a' + 10;
+        else if (i >= 'A' && i <= 'F')
+            t[i] = i - 'A' + 10;
+        else
+            t[i] = -1;
+    }
+    return t;
+}();
+
+#ifdef PRIMITIVES_HASH_SSE2
+// nibbles to lowercase hex characters
+__m128i nibbles_to_hex(__m128i n)
+{
+    auto c = _mm_add_epi8(n, _mm_set1_epi8('0'));
+    auto letters = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+    return _mm_add_epi8(c, _mm_and_si128(letters, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// hex characters to nibbles, bad ones are marked in the mask
+__m128i hex_to_nibbles(__m128i c, __m128i &valid)
+{
+    auto digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    auto is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    auto alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    auto is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    valid = _mm_and_si128(valid, _mm_or_si128(is_digit, is_alpha));
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+        _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+// pairs of nibbles to bytes in 16 bit lanes
+__m128i pack_nibbles(__m128i n)
+{
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x0F)), 4), _mm_srli_epi16(n, 8));
+}
+#endif
+
+#ifdef __AVX2__
+__m256i nibbles_to_hex(__m256i n)
+{
+    auto c = _mm256_add_epi8(n, _mm256_set1_epi8('0'));
+    auto letters = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+    return _mm256_add_epi8(c, _mm256_and_si256(letters, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__m256i hex_to_nibbles(__m256i c, __m256i &valid)
+{
+    auto digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    auto is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    auto alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    auto is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+    valid = _mm256_and_si256(valid, _mm256_or_si256(is_digit, is_alpha));
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+        _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+__m256i pack_nibbles(__m256i n)
+{
+    return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0x0F)), 4), _mm256_srli_epi16(n, 8));
+}
+#endif
+
+}
+
+void bytes_to_string(std::span<const uint8_t> in, std::span<char> out)
+{
+    if (out.size() < in.size() * 2)
+        throw SW_RUNTIME_ERROR("Output buffer is too small");
+
+    auto p = in.data();
+    auto e = p + in.size();
+    auto o = out.data();
+#ifdef __AVX2__
+    for (; e - p >= 32; p += 32, o += 64)
+    {
+        auto v = _mm256_loadu_si256((const __m256i *)p);
+        auto hi = nibbles_to_hex(_mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F)));
+        auto lo = nibbles_to_hex(_mm256_and_si256(v, _mm256_set1_epi8(0x0F)));
+        // unpack works inside 128 bit lanes
+        auto a = _mm256_unpacklo_epi8(hi, lo);
+        auto b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)o, _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(o + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+#endif
+#ifdef PRIMITIVES_HASH_SSE2
+    for (; e - p >= 16; p += 16, o += 32)
+    {
+        auto v = _mm_loadu_si128((const __m128i *)p);
+        auto hi = nibbles_to_hex(_mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F)));
+        auto lo = nibbles_to_hex(_mm_and_si128(v, _mm_set1_epi8(0x0F)));
+        _mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for (; p != e; p++, o += 2)
+        memcpy(o, &hex_pairs[*p * 2], 2);
+}
+
+bool string_to_bytes(std::string_view in, std::span<uint8_t> out)
+{
+    if (in.size() % 2 != 0)
+        return false;
+    if (out.size() < in.size() / 2)
+        throw SW_RUNTIME_ERROR("Output buffer is too small");
+
+    auto p = in.data();
+    auto e = p + in.size();
+    auto o = out.data();
+#ifdef __AVX2__
+    auto valid256 = _mm256_set1_epi8(-1);
+    for (; e - p >= 64; p += 64, o += 32)
+    {
+        auto a = pack_nibbles(hex_to_nibbles(_mm256_loadu_si256((const __m256i *)p), valid256));
+        auto b = pack_nibbles(hex_to_nibbles(_mm256_loadu_si256((const __m256i *)(p + 32)), valid256));
+        // pack works inside 128 bit lanes
+        _mm256_storeu_si256((__m256i *)o, _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    if (_mm256_movemask_epi8(valid256) != -1)
+        return false;
+#endif
+#ifdef PRIMITIVES_HASH_SSE2
+    auto valid = _mm_set1_epi8(-1);
+    for (; e - p >= 32; p += 32, o += 16)
+    {
+        auto a = pack_nibbles(hex_to_nibbles(_mm_loadu_si128((const __m128i *)p), valid));
+        auto b = pack_nibbles(hex_to_nibbles(_mm_loadu_si128((const __m128i *)(p + 16)), valid));
+        _mm_storeu_si128((__m128i *)o, _mm_packus_epi16(a, b));
+    }
+    if (_mm_movemask_epi8(valid) != 0xFFFF)
+        return false;
+#endif
+    for (; p != e; p += 2)
+    {
+        auto hi = hex_values[(uint8_t)p[0]];
+        auto lo = hex_values[(uint8_t)p[1]];
+        if ((hi | lo) < 0)
+            return false;
+        *o++ = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
 String bytes_to_string(const String &bytes)
 {
     return bytes_to_string((uint8_t *)bytes.c_str(), bytes.size());
@@ -65,13 +249,8 @@ String bytes_to_string(const String &bytes)
 
 String bytes_to_string(const uint8_t *bytes, size_t size)
 {
-    String s;
-    s.reserve(size * 2);
-    for (uint32_t i = 0; i < size; i++)
-    {
-        s += alnum[(bytes[i] & 0xF0) >> 4];
-        s += alnum[(bytes[i] & 0x0F) >> 0];
-    }
+    String s(size * 2, 0);
+    bytes_to_string({ bytes, size }, s);
     return s;
 }
 
@@ -82,6 +261,206 @@ String shorten_hash(const String &data, size_t size)
     return data.substr(0, size);
 }
 
+namespace
+{
+
+struct EvpDigest
+{
+    EVP_MD_CTX *ctx;
+    const EVP_MD *md;
+
+    EvpDigest(const EVP_MD *md)
+        : md(md)
+    {
+        ctx = EVP_MD_CTX_create();
+        if (!ctx)
+            throw SW_RUNTIME_ERROR("Cannot create digest context");
+        if (!EVP_DigestInit(ctx, md))
+        {
+            EVP_MD_CTX_destroy(ctx);
+            throw SW_RUNTIME_ERROR("Cannot init digest context");
+        }
+    }
+    EvpDigest(const EvpDigest &) = delete;
+    EvpDigest &operator=(const EvpDigest &) = delete;
+    ~EvpDigest()
+    {
+        EVP_MD_CTX_destroy(ctx);
+    }
+
+    void reset()
+    {
+        EVP_DigestInit_ex(ctx, md, nullptr);
+    }
+
+    void update(const void *data, size_t size)
+    {
+        EVP_DigestUpdate(ctx, data, size);
+    }
+
+    String final()
+    {
+        uint8_t hash[EVP_MAX_MD_SIZE];
+        uint32_t hash_size;
+        EVP_DigestFinal(ctx, hash, &hash_size);
+        return bytes_to_string(hash, hash_size);
+    }
+};
+
+struct Sha3Digest
+{
+    rhash ctx;
+
+    Sha3Digest()
+    {
+        ctx = rhash_init(RHASH_SHA3_256);
+        if (!ctx)
+            throw SW_RUNTIME_ERROR("Cannot create sha3 context");
+    }
+    Sha3Digest(const Sha3Digest &) = delete;
+    Sha3Digest &operator=(const Sha3Digest &) = delete;
+    ~Sha3Digest()
+    {
+        rhash_free(ctx);
+    }
+
+    void reset()
+    {
+        rhash_reset(ctx);
+    }
+
+    void update(const void *data, size_t size)
+    {
+        rhash_update(ctx, data, size);
+    }
+
+    String final()
+    {
+        std::string o(32, 0);
+        rhash_final(ctx, (unsigned char *)&o[0]);
+        return bytes_to_string(o);
+    }
+};
+
+// files are read by chunks of fixed size, so memory does not depend on file size
+const size_t file_chunk_size = 1 << 20;
+
+// read buffer is allocated once per thread
+std::vector<uint8_t> &get_file_buffer()
+{
+    thread_local std::vector<uint8_t> buf(file_chunk_size);
+    return buf;
+}
+
+// all digests are updated in one pass over the data, returns number of bytes read
+template <class ... Digests>
+uint64_t digest_file(const path &fn, Digests & ... ds)
+{
+    auto &buf = get_file_buffer();
+    ScopedFile ifile(fn, "rb");
+    uint64_t sz = 0;
+    while (auto r = ifile.read(buf.data(), buf.size()))
+    {
+        (ds.update(buf.data(), r), ...);
+        sz += r;
+    }
+    if (ferror(ifile.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_printable_string(fn));
+    return sz;
+}
+
+template <class ... Digests>
+void digest_data(const void *data, size_t size, Digests & ... ds)
+{
+    (ds.update(data, size), ...);
+}
+
+template <class D, class ... Args>
+String digest_file(const path &fn, Args && ... args)
+{
+    D d(std::forward<Args>(args)...);
+    digest_file(fn, d);
+    return d.final();
+}
+
+// big endian, like canonical xxhash representation
+String to_hex(uint64_t v)
+{
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++)
+        b[i] = (uint8_t)(v >> (56 - 8 * i));
+    return bytes_to_string(b, sizeof(b));
+}
+
+String to_hex(const primitives::hash::uint128 &v)
+{
+    return to_hex(v.high) + to_hex(v.low);
+}
+
+// contexts are created once per thread
+struct StrongFileHasher
+{
+    EvpDigest sha2{ EVP_sha256() };
+    Sha3Digest sha3;
+    EvpDigest blake2b{ EVP_blake2b512() };
+    primitives::hash::xxh3_64_stream xxh3_64;
+    primitives::hash::xxh3_128_stream xxh3_128;
+
+    static StrongFileHasher &get()
+    {
+        thread_local StrongFileHasher h;
+        return h;
+    }
+
+    String sha3_sha2(const path &fn)
+    {
+        // algorithm:
+        //  sha3_256(sha2(f+sz) + sha3_256(f+sz) + sz)
+        // sha2, sha3_256 - 256 bit versions
+
+        sha2.reset();
+        sha3.reset();
+        auto sz = std::to_string(digest_file(fn, sha2, sha3));
+        digest_data(sz.data(), sz.size(), sha2, sha3);
+        return sha3_256(sha2.final() + sha3.final() + sz);
+    }
+
+    String blake2b_sha3(const path &fn)
+    {
+        // algorithm:
+        //  blake2b_512(sha3_256(data+sz) + blake2b_512(data+sz) + sz)
+
+        sha3.reset();
+        blake2b.reset();
+        auto sz = std::to_string(digest_file(fn, sha3, blake2b));
+        digest_data(sz.data(), sz.size(), sha3, blake2b);
+        return save_strong_hash_prefix(HashType::blake2b_512, HashType::sha3_256) + blake2b_512(sha3.final() + blake2b.final() + sz);
+    }
+
+    String hash(const path &fn, HashType type)
+    {
+        switch (type)
+        {
+        case HashType::sha3_256:
+            return sha3_sha2(fn);
+        case HashType::blake2b_512:
+            return blake2b_sha3(fn);
+        case HashType::xxh3_64:
+            xxh3_64.reset();
+            digest_file(fn, xxh3_64);
+            return to_hex(xxh3_64.digest());
+        case HashType::xxh3_128:
+            xxh3_128.reset();
+            digest_file(fn, xxh3_128);
+            return to_hex(xxh3_128.digest());
+        default:
+            throw SW_RUNTIME_ERROR("Unknown hash type: " + std::to_string((int)type));
+        }
+    }
+};
+
+}
+
 String sha1(const String &data)
 {
     uint8_t hash[EVP_MAX_MD_SIZE];
@@ -108,7 +487,7 @@ String blake2b_512(const String &data)
 
 String sha256_file(const path &fn)
 {
-    return sha256(read_file(fn));
+    return digest_file<EvpDigest>(fn, EVP_sha256());
 }
 
 String sha3_256(const String &data)
@@ -120,10 +499,100 @@ String sha3_256(const String &data)
 
 String sha3_256_file(const path &fn)
 {
-    std::string o(32, 0);
-    auto data = read_file(fn);
-    rhash_msg(RHASH_SHA3_256, &data[0], data.size(), (unsigned char *)&o[0]);
-    return bytes_to_string(o);
+    return digest_file<Sha3Digest>(fn);
+}
+
+uint64_t xxh3_64(const void *data, size_t size, uint64_t seed)
+{
+    return XXH3_64bits_withSeed(data, size, seed);
+}
+
+uint64_t xxh3_64(const String &data)
+{
+    return xxh3_64(data.data(), data.size());
+}
+
+uint64_t xxh3_64_file(const path &fn)
+{
+    auto &s = StrongFileHasher::get().xxh3_64;
+    s.reset();
+    digest_file(fn, s);
+    return s.digest();
+}
+
+String xxh3_128(const String &data)
+{
+    auto h = XXH3_128bits(data.data(), data.size());
+    return to_hex(primitives::hash::uint128{ h.low64, h.high64 });
+}
+
+String xxh3_128_file(const path &fn)
+{
+    auto &s = StrongFileHasher::get().xxh3_128;
+    s.reset();
+    digest_file(fn, s);
+    return to_hex(s.digest());
+}
+
+namespace primitives::hash {
+
+xxh3_64_stream::xxh3_64_stream(uint64_t seed)
+{
+    state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create xxh3 state");
+    reset(seed);
+}
+
+xxh3_64_stream::~xxh3_64_stream()
+{
+    XXH3_freeState((XXH3_state_t *)state);
+}
+
+void xxh3_64_stream::reset(uint64_t seed)
+{
+    XXH3_64bits_reset_withSeed((XXH3_state_t *)state, seed);
+}
+
+void xxh3_64_stream::update(const void *data, size_t size)
+{
+    XXH3_64bits_update((XXH3_state_t *)state, data, size);
+}
+
+uint64_t xxh3_64_stream::digest() const
+{
+    return XXH3_64bits_digest((const XXH3_state_t *)state);
+}
+
+xxh3_128_stream::xxh3_128_stream(uint64_t seed)
+{
+    state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create xxh3 state");
+    reset(seed);
+}
+
+xxh3_128_stream::~xxh3_128_stream()
+{
+    XXH3_freeState((XXH3_state_t *)state);
+}
+
+void xxh3_128_stream::reset(uint64_t seed)
+{
+    XXH3_128bits_reset_withSeed((XXH3_state_t *)state, seed);
+}
+
+void xxh3_128_stream::update(const void *data, size_t size)
+{
+    XXH3_128bits_update((XXH3_state_t *)state, data, size);
+}
+
+uint128 xxh3_128_stream::digest() const
+{
+    auto h = XXH3_128bits_digest((const XXH3_state_t *)state);
+    return { h.low64, h.high64 };
+}
+
 }
 
 String md5(const String &data)
@@ -136,7 +605,7 @@ String md5(const String &data)
 
 String md5_file(const path &fn)
 {
-    return md5(read_file(fn));
+    return digest_file<EvpDigest>(fn, EVP_md5());
 }
 
 std::tuple<HashType, HashType> load_strong_hash_prefix(const String &hash)
@@ -162,57 +631,17 @@ String strong_file_hash(const String &data)
     //  sha3_256(sha2(f+sz) + sha3_256(f+sz) + sz)
     // sha2, sha3_256 - 256 bit versions
 
+    EvpDigest sha2(EVP_sha256());
+    Sha3Digest sha3;
     auto sz = std::to_string(data.size());
-    auto f = data + sz;
-    return sha3_256(sha256(f) + sha3_256(f) + sz);
+    digest_data(data.data(), data.size(), sha2, sha3);
+    digest_data(sz.data(), sz.size(), sha2, sha3);
+    return sha3_256(sha2.final() + sha3.final() + sz);
 }
 
 String strong_file_hash_file(const path &fn)
 {
-    // algorithm:
-    //  sha3_256(sha2(f+sz) + sha3_256(f+sz) + sz)
-    // sha2, sha3_256 - 256 bit versions
-
-    uint8_t hash2[EVP_MAX_MD_SIZE];
-    uint32_t hash2_size;
-
-    std::string hash3(32, 0);
-
-    auto sha2_256_ctx = EVP_MD_CTX_create();
-    if (!sha2_256_ctx)
-        throw SW_RUNTIME_ERROR("Cannot create sha2 context");
-    EVP_DigestInit(sha2_256_ctx, EVP_sha256());
-
-    auto sha3_256_ctx = rhash_init(RHASH_SHA3_256);
-    if (!sha3_256_ctx)
-        throw SW_RUNTIME_ERROR("Cannot create sha3 context");
-
-    FileIterator fi({ fn });
-    auto r = fi.iterate([sha2_256_ctx, sha3_256_ctx](const auto &b, auto sz)
-    {
-        EVP_DigestUpdate(sha2_256_ctx, b[0].get().data(), (size_t)sz);
-        rhash_update(sha3_256_ctx, b[0].get().data(), (size_t)sz);
-        return true;
-    });
-
-    // add size
-    auto sz = std::to_string(fi.files.front().size);
-    EVP_DigestUpdate(sha2_256_ctx, sz.data(), sz.size());
-    rhash_update(sha3_256_ctx, sz.data(), sz.size());
-
-    EVP_DigestFinal(sha2_256_ctx, hash2, &hash2_size);
-    rhash_final(sha3_256_ctx, (unsigned char *)&hash3[0]);
-
-    EVP_MD_CTX_destroy(sha2_256_ctx);
-    rhash_free(sha3_256_ctx);
-
-    if (!r)
-        throw SW_RUNTIME_ERROR("Error during strong_file_hash()");
-
-    auto p1 = bytes_to_string(hash2, hash2_size);
-    auto p2 = bytes_to_string(hash3);
-    auto &p3 = sz;
-    return sha3_256(p1 + p2 + p3);
+    return StrongFileHasher::get().sha3_sha2(fn);
 }
 
 String strong_file_hash_sha3_sha2(const String &data)
@@ -230,54 +659,89 @@ String strong_file_hash_blake2b_sha3(const String &data)
     // algorithm:
     //  blake2b_512(sha3_256(data+sz) + blake2b_512(data+sz) + sz)
 
+    Sha3Digest sha3;
+    EvpDigest blake2b(EVP_blake2b512());
     auto sz = std::to_string(data.size());
-    auto f = data + sz;
-    return save_strong_hash_prefix(HashType::blake2b_512, HashType::sha3_256) + blake2b_512(sha3_256(f) + blake2b_512(f) + sz);
+    digest_data(data.data(), data.size(), sha3, blake2b);
+    digest_data(sz.data(), sz.size(), sha3, blake2b);
+    return save_strong_hash_prefix(HashType::blake2b_512, HashType::sha3_256) + blake2b_512(sha3.final() + blake2b.final() + sz);
 }
 
 String strong_file_hash_file_blake2b_sha3(const path &fn)
 {
-    // algorithm:
-    //  blake2b_512(sha3_256(data+sz) + blake2b_512(data+sz) + sz)
-
-    uint8_t blake2b[EVP_MAX_MD_SIZE];
-    uint32_t blake2b_size;
-
-    std::string sha3(32, 0);
-
-    auto blake2b_ctx = EVP_MD_CTX_create();
-    if (!blake2b)
-        throw SW_RUNTIME_ERROR("Cannot create blake2b context");
-    EVP_DigestInit(blake2b_ctx, EVP_blake2b512());
+    return StrongFileHasher::get().blake2b_sha3(fn);
+}
 
-    auto sha3_256_ctx = rhash_init(RHASH_SHA3_256);
-    if (!sha3_256_ctx)
-        throw SW_RUNTIME_ERROR("Cannot create sha3 context");
+std::unordered_map<path, String> hash_files(Executor &e, const FilesOrdered &files, HashType type)
+{
+    // small files are hashed in batches in the order of their inodes, which is close to the disk order,
+    // large ones get a task each and start first, so they do not delay the end
+    const uint64_t large_file_size = 4 * file_chunk_size;
+    const uint64_t batch_size = 4 * file_chunk_size;
+    const size_t batch_files = 256;
 
-    FileIterator fi({ fn });
-    auto r = fi.iterate([blake2b_ctx, sha3_256_ctx](const auto &b, auto sz)
+    struct File
     {
-        EVP_DigestUpdate(blake2b_ctx, b[0].get().data(), (size_t)sz);
-        rhash_update(sha3_256_ctx, b[0].get().data(), (size_t)sz);
-        return true;
-    });
-
-    // add size
-    auto sz = std::to_string(fi.files.front().size);
-    EVP_DigestUpdate(blake2b_ctx, sz.data(), sz.size());
-    rhash_update(sha3_256_ctx, sz.data(), sz.size());
-
-    EVP_DigestFinal(blake2b_ctx, blake2b, &blake2b_size);
-    rhash_final(sha3_256_ctx, (unsigned char *)&sha3[0]);
+        const path *fn;
+        uint64_t size = 0;
+        uint64_t inode = 0;
+        String hash;
+    };
+
+    std::vector<File> small, large;
+    for (auto &fn : files)
+    {
+        File f;
+        f.fn = &fn;
+#ifdef _WIN32
+        f.size = fs::file_size(fn);
+#else
+        struct stat st;
+        if (::stat(fn.c_str(), &st) != 0)
+            throw SW_RUNTIME_ERROR("Cannot stat file: " + to_printable_string(fn));
+        f.size = st.st_size;
+        f.inode = st.st_ino;
+#endif
+        (f.size >= large_file_size ? large : small).push_back(std::move(f));
+    }
+    std::sort(large.begin(), large.end(), [](const auto &f1, const auto &f2) { return f1.size > f2.size; });
+    std::stable_sort(small.begin(), small.end(), [](const auto &f1, const auto &f2) { return f1.inode < f2.inode; });
 
-    EVP_MD_CTX_destroy(blake2b_ctx);
-    rhash_free(sha3_256_ctx);
+    auto hash_range = [type](File *b, File *e)
+    {
+        auto &h = StrongFileHasher::get();
+        for (; b != e; ++b)
+            b->hash = h.hash(*b->fn, type);
+    };
+
+    Futures<void> fs;
+    // tasks reference local data, so all of them must finish before errors are thrown,
+    // push() may throw too
+    SCOPE_EXIT
+    {
+        for (auto &f : fs)
+            f.wait();
+    };
+    for (auto &f : large)
+        fs.push_back(e.push([&hash_range, &f] { hash_range(&f, &f + 1); }));
+    for (size_t i = 0; i < small.size();)
+    {
+        auto b = i;
+        uint64_t sz = 0;
+        for (; i < small.size() && i - b < batch_files && sz < batch_size; i++)
+            sz += small[i].size;
+        fs.push_back(e.push([&hash_range, p = small.data(), b, i] { hash_range(p + b, p + i); }));
+    }
 
-    if (!r)
-        throw SW_RUNTIME_ERROR("Error during strong_file_hash_blake2b_sha3()");
+    for (auto &f : fs)
+        f.get();
 
-    auto p1 = bytes_to_string(sha3);
-    auto p2 = bytes_to_string(blake2b, blake2b_size);
-    auto &p3 = sz;
-    return save_strong_hash_prefix(HashType::blake2b_512, HashType::sha3_256) + blake2b_512(p1 + p2 + p3);
+    std::unordered_map<path, String> m;
+    m.reserve(files.size());
+    for (auto *v : { &small, &large })
+    {
+        for (auto &f : *v)
+            m.emplace(*f.fn, std::move(f.hash));
+    }
+    return m;
 }
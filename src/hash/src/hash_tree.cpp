@@ -0,0 +1,378 @@
+// Copyright (C) 2026 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <primitives/hash_tree.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace primitives::hash {
+
+static const String file_manifest_header = "primitives.hash_tree.file 2";
+static const String dir_manifest_header = "primitives.hash_tree.dir 2";
+
+// first byte of hashed data, so a leaf, a node and a root cannot be taken for one another (like in RFC 6962)
+// directory data starts with a text line
+static const char leaf_prefix = 0;
+static const char node_prefix = 1;
+static const char root_prefix = 2;
+
+static String digest(HashType type, const String &data)
+{
+    switch (type)
+    {
+    case HashType::sha2_256:
+        return sha256(data);
+    case HashType::sha3_256:
+        return sha3_256(data);
+    case HashType::blake2b_512:
+        return blake2b_512(data);
+    case HashType::xxh3_128:
+        return xxh3_128(data);
+    default:
+        throw SW_RUNTIME_ERROR("Unsupported hash tree type: " + std::to_string((int)type));
+    }
+}
+
+static String to_manifest_string(const path &p)
+{
+    auto s = normalize_path(p).u8string();
+    return String((const char *)s.data(), s.size());
+}
+
+static path from_manifest_string(const String &s)
+{
+    return std::u8string((const char8_t *)s.data(), s.size());
+}
+
+static void check_header(std::istream &in, const String &header, const path &manifest)
+{
+    String s;
+    std::getline(in, s);
+    if (s != header)
+        throw SW_RUNTIME_ERROR("Bad hash tree manifest: " + to_printable_string(manifest));
+}
+
+file_tree::file_tree(const path &fn, HashType type, uint64_t chunk_size)
+    : type(type), chunk_size(chunk_size)
+{
+    if (chunk_size == 0)
+        throw SW_RUNTIME_ERROR("Hash tree chunk size must be positive");
+    update(fn, 0, UINT64_MAX);
+}
+
+const String &file_tree::root() const
+{
+    if (levels.empty())
+        throw SW_RUNTIME_ERROR("Empty hash tree");
+    return root_hash;
+}
+
+void file_tree::update(const path &fn, uint64_t offset, uint64_t count)
+{
+    auto old_size = size;
+    auto old_chunks = chunks();
+    size = fs::file_size(fn);
+    // empty file still has one (empty) chunk
+    auto n = std::max<size_t>(1, (size + chunk_size - 1) / chunk_size);
+
+    std::vector<size_t> dirty;
+    if (offset < size)
+    {
+        auto end = count > size - offset ? size : offset + count;
+        for (auto i = offset / chunk_size; i < (end + chunk_size - 1) / chunk_size; i++)
+            dirty.push_back(i);
+    }
+    // old last chunk may be partial, new chunks are always dirty
+    if (levels.empty() || size != old_size)
+    {
+        auto m = std::min(old_chunks, n);
+        for (auto i = m ? m - 1 : 0; i < n; i++)
+            dirty.push_back(i);
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    if (levels.empty())
+        levels.emplace_back();
+    levels[0].resize(n);
+    if (dirty.empty())
+        return;
+
+    ScopedFile f(fn);
+    String buf;
+    for (auto i : dirty)
+    {
+        buf.resize(chunk_size + 1);
+        buf[0] = leaf_prefix;
+        f.seek(i * chunk_size);
+        buf.resize(f.read(buf.data() + 1, chunk_size) + 1);
+        levels[0][i] = digest(type, buf);
+    }
+    rebuild(std::move(dirty));
+}
+
+void file_tree::rebuild(std::vector<size_t> dirty)
+{
+    size_t l = 0;
+    for (; levels[l].size() > 1; l++)
+    {
+        auto n = (levels[l].size() + 1) / 2;
+        if (levels.size() == l + 1)
+            levels.emplace_back();
+        auto &cur = levels[l];
+        auto &next = levels[l + 1];
+
+        std::vector<size_t> up;
+        for (auto i : dirty)
+        {
+            if (up.empty() || up.back() != i / 2)
+                up.push_back(i / 2);
+        }
+        // level has grown or shrunk, its tail must be recalculated
+        if (next.size() != n)
+        {
+            auto m = std::min(next.size(), n);
+            for (auto i = m ? m - 1 : 0; i < n; i++)
+                up.push_back(i);
+            std::sort(up.begin(), up.end());
+            up.erase(std::unique(up.begin(), up.end()), up.end());
+            next.resize(n);
+        }
+
+        // odd node is promoted to the upper level as is
+        for (auto i : up)
+            next[i] = 2 * i + 1 < cur.size() ? digest(type, node_prefix + cur[2 * i] + cur[2 * i + 1]) : cur[2 * i];
+        dirty = std::move(up);
+    }
+    levels.resize(l + 1);
+    // files with equal chunks, but different lengths or chunking differ
+    root_hash = digest(type, root_prefix + std::to_string(size) + " " + std::to_string(chunk_size) + " " + levels[l][0]);
+}
+
+std::vector<size_t> file_tree::diff(const file_tree &rhs) const
+{
+    if (type != rhs.type || chunk_size != rhs.chunk_size)
+        throw SW_RUNTIME_ERROR("Cannot compare hash trees of different types or chunk sizes");
+
+    std::vector<size_t> r;
+    if (chunks() != rhs.chunks())
+    {
+        // different shapes, compare leaves
+        for (size_t i = 0; i < std::max(chunks(), rhs.chunks()); i++)
+        {
+            if (i >= chunks() || i >= rhs.chunks() || levels[0][i] != rhs.levels[0][i])
+                r.push_back(i);
+        }
+        return r;
+    }
+    if (levels.empty())
+        return r;
+
+    auto walk = [this, &rhs, &r](auto &&walk, size_t l, size_t i) -> void
+    {
+        if (levels[l][i] == rhs.levels[l][i])
+            return;
+        if (l == 0)
+        {
+            r.push_back(i);
+            return;
+        }
+        walk(walk, l - 1, 2 * i);
+        if (2 * i + 1 < levels[l - 1].size())
+            walk(walk, l - 1, 2 * i + 1);
+    };
+    walk(walk, levels.size() - 1, 0);
+    return r;
+}
+
+void file_tree::save(const path &manifest) const
+{
+    String s;
+    s += file_manifest_header + "\n";
+    s += std::to_string((int)type) + " " + std::to_string(chunk_size) + " " + std::to_string(size) + "\n";
+    if (!levels.empty())
+    {
+        for (auto &h : levels[0])
+            s += h + "\n";
+    }
+    write_file(manifest, s);
+}
+
+file_tree file_tree::load(const path &manifest)
+{
+    std::istringstream in(read_file(manifest));
+    check_header(in, file_manifest_header, manifest);
+
+    file_tree t;
+    int type = 0;
+    in >> type >> t.chunk_size >> t.size;
+    if (!in || t.chunk_size == 0)
+        throw SW_RUNTIME_ERROR("Bad hash tree manifest: " + to_printable_string(manifest));
+    t.type = (HashType)type;
+
+    auto &leaves = t.levels.emplace_back();
+    String h;
+    while (in >> h)
+        leaves.push_back(h);
+    if (leaves.size() != std::max<size_t>(1, (t.size + t.chunk_size - 1) / t.chunk_size))
+        throw SW_RUNTIME_ERROR("Bad hash tree manifest: " + to_printable_string(manifest));
+
+    std::vector<size_t> dirty(leaves.size());
+    for (size_t i = 0; i < dirty.size(); i++)
+        dirty[i] = i;
+    t.rebuild(std::move(dirty));
+    return t;
+}
+
+dir_tree::dir_tree(const path &dir, HashType type, uint64_t chunk_size)
+    : dir(dir), type(type), chunk_size(chunk_size)
+{
+    if (chunk_size == 0)
+        throw SW_RUNTIME_ERROR("Hash tree chunk size must be positive");
+    update();
+}
+
+const String &dir_tree::root() const
+{
+    auto i = dirs.find(path{});
+    if (i == dirs.end())
+        throw SW_RUNTIME_ERROR("Empty hash tree");
+    return i->second;
+}
+
+FilesSorted dir_tree::update()
+{
+    FilesSorted changed;
+    std::map<path, file> now;
+    if (fs::exists(dir))
+    {
+        for (auto &e : fs::recursive_directory_iterator(dir))
+        {
+            if (!e.is_regular_file())
+                continue;
+            auto rel = normalize_path(e.path().lexically_relative(dir));
+            file f;
+            f.size = e.file_size();
+            f.mtime = e.last_write_time().time_since_epoch().count();
+            auto i = files.find(rel);
+            if (i != files.end() && i->second.size == f.size && i->second.mtime == f.mtime)
+                f.hash = i->second.hash;
+            else
+            {
+                // only new and modified files are read
+                f.hash = file_tree(e.path(), type, chunk_size).root();
+                if (i == files.end() || i->second.hash != f.hash)
+                    changed.insert(rel);
+            }
+            now.emplace(std::move(rel), std::move(f));
+        }
+    }
+    for (auto &[p, f] : files)
+    {
+        if (!now.contains(p))
+            changed.insert(p);
+    }
+    files = std::move(now);
+    rebuild();
+    return changed;
+}
+
+void dir_tree::rebuild()
+{
+    // dir -> sorted children: name -> file hash or empty for subdirs
+    std::map<path, std::map<String, const String *>> children;
+    children[path{}];
+    for (auto &[p, f] : files)
+    {
+        children[p.parent_path()][to_manifest_string(p.filename())] = &f.hash;
+        for (auto d = p.parent_path(); !d.empty(); d = d.parent_path())
+            children[d.parent_path()].emplace(to_manifest_string(d.filename()), nullptr);
+    }
+
+    // parents are sorted before their subdirs, so go backwards
+    dirs.clear();
+    for (auto i = children.rbegin(); i != children.rend(); ++i)
+    {
+        String s;
+        for (auto &[name, h] : i->second)
+        {
+            if (h)
+                s += "f " + name + " " + *h + "\n";
+            else
+                s += "d " + name + " " + dirs[i->first / from_manifest_string(name)] + "\n";
+        }
+        dirs[i->first] = digest(type, s);
+    }
+}
+
+FilesSorted dir_tree::diff(const dir_tree &rhs) const
+{
+    if (type != rhs.type || chunk_size != rhs.chunk_size)
+        throw SW_RUNTIME_ERROR("Cannot compare hash trees of different types or chunk sizes");
+
+    FilesSorted r;
+    if (root() == rhs.root())
+        return r;
+    for (auto &[p, f] : files)
+    {
+        auto i = rhs.files.find(p);
+        if (i == rhs.files.end() || i->second.hash != f.hash)
+            r.insert(p);
+    }
+    for (auto &[p, f] : rhs.files)
+    {
+        if (!files.contains(p))
+            r.insert(p);
+    }
+    return r;
+}
+
+void dir_tree::save(const path &manifest) const
+{
+    String s;
+    s += dir_manifest_header + "\n";
+    s += std::to_string((int)type) + " " + std::to_string(chunk_size) + "\n";
+    for (auto &[p, f] : files)
+        s += std::to_string(f.size) + " " + std::to_string(f.mtime) + " " + f.hash + " " + to_manifest_string(p) + "\n";
+    write_file(manifest, s);
+}
+
+dir_tree dir_tree::load(const path &manifest, const path &dir)
+{
+    std::istringstream in(read_file(manifest));
+    check_header(in, dir_manifest_header, manifest);
+
+    dir_tree t;
+    t.dir = dir;
+    int type = 0;
+    in >> type >> t.chunk_size;
+    if (!in || t.chunk_size == 0)
+        throw SW_RUNTIME_ERROR("Bad hash tree manifest: " + to_printable_string(manifest));
+    t.type = (HashType)type;
+    in.ignore(1);
+
+    String line;
+    while (std::getline(in, line))
+    {
+        if (line.empty())
+            continue;
+        // path is the rest of the line, it may contain spaces
+        std::istringstream l(line);
+        file f;
+        l >> f.size >> f.mtime >> f.hash;
+        if (!l || f.hash.empty())
+            throw SW_RUNTIME_ERROR("Bad hash tree manifest: " + to_printable_string(manifest));
+        l.ignore(1);
+        String p;
+        std::getline(l, p);
+        t.files.emplace(from_manifest_string(p), std::move(f));
+    }
+    t.rebuild();
+    return t;
+}
+
+}
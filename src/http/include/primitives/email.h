@@ -1,33 +1,59 @@
+#include <primitives/filesystem.h>
 #include <primitives/string.h>
+#include <primitives/templates2/base64.h>
 
 #include <curl/curl.h>
 
+#include <chrono>
+#include <functional>
+#include <memory>
+
 namespace primitives
 {
 
 namespace detail {
-
+
 struct upload_status
-{
-    int lines_read = 0;
-    Strings payload;
+{
+    // parts are read one by one, a part returns 0 when it is done
+    std::vector<std::function<size_t(char *, size_t)>> parts;
+    size_t current = 0;
+
+    void add(String s)
+    {
+        parts.emplace_back([s = std::move(s), pos = (size_t)0](char *p, size_t n) mutable
+        {
+            n = std::min(n, s.size() - pos);
+            memcpy(p, s.data() + pos, n);
+            pos += n;
+            return n;
+        });
+    }
+
+    // file is read and encoded by chunks, it is never loaded into memory
+    void add_base64(const path &fn)
+    {
+        auto f = std::make_shared<ScopedFile>(fn, "rb");
+        auto read = [f](char *p, size_t n) { return f->read(p, n); };
+        auto enc = std::make_shared<::base64::encode_reader<decltype(read)>>(read, 76);
+        parts.emplace_back([enc](char *p, size_t n) { return enc->read(p, n); });
+    }
 };
-
-static size_t payload_source(void *ptr, size_t size, size_t nmemb, void *userp)
-{
-    upload_status *upload_ctx = (upload_status *)userp;
-
-    if (size == 0 || nmemb == 0)
-        return 0;
 
-    if (upload_ctx->lines_read >= upload_ctx->payload.size())
+static size_t payload_source(void *ptr, size_t size, size_t nmemb, void *userp)
+{
+    upload_status *upload_ctx = (upload_status *)userp;
+
+    if (size == 0 || nmemb == 0)
         return 0;
 
-    auto &s = upload_ctx->payload[upload_ctx->lines_read];
-    memcpy(ptr, s.data(), s.size());
-    upload_ctx->lines_read++;
-
-    return s.size();
+    // fill no more than curl buffer
+    for (; upload_ctx->current < upload_ctx->parts.size(); upload_ctx->current++)
+    {
+        if (auto n = upload_ctx->parts[upload_ctx->current]((char *)ptr, size * nmemb))
+            return n;
+    }
+    return 0;
 }
 
 } // namespace detail
@@ -45,8 +71,52 @@ struct Email
     Person from;
     String title;
     String body;
+    /// sent as base64 mime parts (multipart/mixed)
+    FilesOrdered attachments;
 
+    /// body is sent as is, attachments are ignored
     bool custom_email = false;
+
+    detail::upload_status payload() const
+    {
+        detail::upload_status uctx;
+        if (custom_email)
+        {
+            uctx.add(body);
+            return uctx;
+        }
+        uctx.add("To: " + to.name + " <" + to.email + ">" + "\r\n");
+        uctx.add("From: " + from.name + " <" + from.email + ">" + "\r\n");
+        for (auto &s : cc)
+            uctx.add("Cc: " + s.name + " <" + s.email + ">" + "\r\n");
+        uctx.add("Subject: " + title + "\r\n");
+        if (attachments.empty())
+        {
+            uctx.add("\r\n");
+            uctx.add(body);
+            return uctx;
+        }
+
+        // '_' is not in the base64 alphabet
+        String boundary = "=_primitives_" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+        uctx.add("MIME-Version: 1.0\r\n");
+        uctx.add("Content-Type: multipart/mixed; boundary=\"" + boundary + "\"\r\n\r\n");
+        uctx.add("--" + boundary + "\r\n");
+        uctx.add("Content-Type: text/plain; charset=utf-8\r\n\r\n");
+        uctx.add(body + "\r\n");
+        for (auto &fn : attachments)
+        {
+            auto name = to_string(fn.filename().u8string());
+            uctx.add("--" + boundary + "\r\n");
+            uctx.add("Content-Type: application/octet-stream; name=\"" + name + "\"\r\n");
+            uctx.add("Content-Transfer-Encoding: base64\r\n");
+            uctx.add("Content-Disposition: attachment; filename=\"" + name + "\"\r\n\r\n");
+            uctx.add_base64(fn);
+            uctx.add("\r\n");
+        }
+        uctx.add("--" + boundary + "--\r\n");
+        return uctx;
+    }
 };
 
 struct Smtp
@@ -86,18 +156,7 @@ struct Smtp
 
         curl_easy_setopt(curl, CURLOPT_READFUNCTION, detail::payload_source);
 
-        detail::upload_status uctx;
-        if (!e.custom_email)
-        {
-            uctx.payload.push_back("To: " + e.to.name + " <" + e.to.email + ">" + "\r\n");
-            uctx.payload.push_back("From: " + e.from.name + " <" + e.from.email + ">" + "\r\n");
-            for (auto &s : e.cc)
-                uctx.payload.push_back("Cc: " + s.name + " <" + s.email + ">" + "\r\n");
-            uctx.payload.push_back("Subject: " + e.title + "\r\n");
-            uctx.payload.push_back("\r\n");
-        }
-        uctx.payload.push_back(e.body);
-
+        auto uctx = e.payload();
         curl_easy_setopt(curl, CURLOPT_READDATA, &uctx);
         curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
 
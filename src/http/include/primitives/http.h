@@ -61,6 +61,8 @@ struct HttpRequest : public HttpSettings
     int connect_timeout = -1;
     String cookie; // single string
     path upload_file;
+    /// upload_file is sent base64 encoded
+    bool upload_base64 = false;
     std::unordered_map<String, mime_data> form_data;
     std::vector<std::pair<String, mime_data>> form_data_vec;
     std::vector<String> headers;
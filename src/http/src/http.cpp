@@ -6,7 +6,11 @@
 
 #include <primitives/http.h>
 
+#include <primitives/debug.h>
 #include <primitives/exceptions.h>
+#include <primitives/templates2/base64.h>
+
+#include <functional>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -38,6 +42,13 @@ String getAutoProxy()
     return proxy_addr;
 }
 
+static CURLcode curl_perform(CURL *curl)
+{
+    // let thread pools start more workers while we wait for network
+    primitives::ScopedBlockingRegion br;
+    return curl_easy_perform(curl);
+}
+
 static auto curl_write_file(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     auto n = fwrite(ptr, size, nmemb, (FILE *)userdata);
@@ -78,6 +89,8 @@ struct CurlWrapper
     //path_u8string ca_certs_file;
     //path_u8string ca_certs_dir;
     FILE *upload_file{nullptr};
+    using base64_reader = base64::encode_reader<std::function<size_t(char *, size_t)>>;
+    std::unique_ptr<base64_reader> upload_base64;
 
     CurlWrapper()
     {
@@ -164,8 +177,17 @@ static std::unique_ptr<CurlWrapper> setup_curl_request(const HttpRequest &reques
         } else {
             //curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, sz);
         }
-        curl_easy_setopt(curl, CURLOPT_READDATA, wp->upload_file);
-        curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+        if (request.upload_base64) {
+            // encoded by chunks while curl reads
+            wp->upload_base64 = std::make_unique<CurlWrapper::base64_reader>([f = wp->upload_file](char *p, size_t n) {
+                return fread(p, 1, n, f);
+            });
+            curl_easy_setopt(curl, CURLOPT_READDATA, wp->upload_base64.get());
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, CurlWrapper::base64_reader::read_callback);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_READDATA, wp->upload_file);
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+        }
     }
 
     // proxy settings
@@ -279,7 +301,7 @@ void download_file(const String &url, const path &fn, int64_t file_size_limit)
     auto [w,ofile] = setup_download_request(url, tmpfn, file_size_limit);
     auto curl = w->curl;
 
-    auto res = curl_easy_perform(curl);
+    auto res = curl_perform(curl);
 
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
@@ -322,7 +344,7 @@ HttpResponse url_request(const HttpRequest &request)
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.response);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_string);
 
-    auto res = curl_easy_perform(curl);
+    auto res = curl_perform(curl);
 
     if (res == CURLE_PROXY) {
         long proxycode;
@@ -474,7 +496,7 @@ bool downloadOrUpdateCaCertificatesBundle(const path &destfn, String url)
     curl_easy_setopt(curl, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
     //
 
-    auto res = curl_easy_perform(curl);
+    auto res = curl_perform(curl);
 
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
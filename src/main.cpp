@@ -6,17 +6,26 @@
 
 #define NOMINMAX
 #include <primitives/command.h>
+#include <primitives/cron.h>
 #include <primitives/emitter.h>
 #include <primitives/date_time.h>
+#include <primitives/email.h>
 #include <primitives/executor.h>
 #include <primitives/filesystem.h>
 #include <primitives/hash.h>
+#include <primitives/hash_tree.h>
+#include <primitives/templates2/base64.h>
+#include <primitives/templates2/crc32.h>
+#include <primitives/templates2/mmap.h>
+#include <primitives/templates2/record_file.h>
 //#include <primitives/sw/main.h>
 
 #include <boost/algorithm/string.hpp>
 
 #include <chrono>
 #include <iostream>
+#include <list>
+#include <numeric>
 
 //#define CATCH_CONFIG_RUNNER
 #include <catch2/catch_all.hpp>
@@ -91,9 +100,312 @@ TEST_CASE("Checking hashes", "[hash]")
     CHECK(strong_file_hash("The quick brown fox jumps over the lazy dog."s) == "853af62ed82f1c9079c2a1ee3f28806a520dc48fb702091e8f375466d7c484c0");
     CHECK(strong_file_hash_file(fox_point_file) == "853af62ed82f1c9079c2a1ee3f28806a520dc48fb702091e8f375466d7c484c0");
 
+    // files are hashed by chunks
+    path big_file;
+    String big(3 * 1024 * 1024 + 17, 0);
+    for (size_t i = 0; i < big.size(); i++)
+        big[i] = (char)(i * 31 + 7);
+    write_file(big_file = fs::temp_directory_path() / unique_path(), big);
+    CHECK(md5_file(big_file) == md5(big));
+    CHECK(sha256_file(big_file) == sha256(big));
+    CHECK(sha3_256_file(big_file) == sha3_256(big));
+    CHECK(strong_file_hash_file(big_file) == strong_file_hash(big));
+    CHECK(strong_file_hash_file_blake2b_sha3(big_file) == strong_file_hash_blake2b_sha3(big));
+
     fs::remove(empty_file);
     fs::remove(fox_file);
     fs::remove(fox_point_file);
+    fs::remove(big_file);
+}
+
+TEST_CASE("Checking hashes: hex", "[hash]")
+{
+    String data;
+    for (int i = 0; i < 100; i++)
+        data += (char)(i * 37);
+    auto h = bytes_to_string(data);
+    CHECK(h.substr(0, 10) == "00254a6f94");
+    CHECK(bytes_to_string(""s).empty());
+
+    char out[200];
+    bytes_to_string({ (const uint8_t *)data.data(), data.size() }, out);
+    CHECK(String(out, 200) == h);
+    CHECK_THROWS(bytes_to_string({ (const uint8_t *)data.data(), data.size() }, std::span<char>(out, 199)));
+
+    uint8_t b[100];
+    CHECK(string_to_bytes(h, b));
+    CHECK(memcmp(b, data.data(), 100) == 0);
+    CHECK(string_to_bytes(boost::to_upper_copy(h), b));
+    CHECK(memcmp(b, data.data(), 100) == 0);
+    CHECK_FALSE(string_to_bytes(h.substr(1), b));
+    for (auto c : { 'g', 'G', ' ', '/', ':', '@', '`', '\xff' })
+    {
+        auto bad = h;
+        bad[77] = c;
+        CHECK_FALSE(string_to_bytes(bad, b));
+    }
+
+    CHECK(String(primitives::hash::bytes("0aFF"s)) == "0aff");
+    CHECK_THROWS(primitives::hash::bytes("0x"s));
+    CHECK_THROWS(primitives::hash::bytes("abc"s));
+}
+
+TEST_CASE("Benchmarking hashes: hex", "[.][hash][benchmark]")
+{
+    auto digest = blake2b_512(""s);
+    uint8_t b[64];
+    char s[128];
+    BENCHMARK("encode 64 bytes")
+    {
+        bytes_to_string({ b, sizeof(b) }, s);
+        return s[0];
+    };
+    BENCHMARK("decode 64 bytes")
+    {
+        return string_to_bytes(digest, b);
+    };
+}
+
+TEST_CASE("Checking hashes: xxh3", "[hash]")
+{
+    CHECK(xxh3_64(""s) == 0x2D06800538D394C2ULL);
+    CHECK(xxh3_128(""s) == "99aa06d3014798d86001c324468d497f");
+
+    String data(1024 * 1024 + 33, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 131 + 1);
+
+    // streaming gives the same result for any split
+    primitives::hash::xxh3_64_stream s64;
+    primitives::hash::xxh3_128_stream s128;
+    for (size_t i = 0, n = 1; i < data.size(); i += n, n = n * 3 + 1)
+    {
+        auto sz = std::min(n, data.size() - i);
+        s64.update(data.data() + i, sz);
+        s128.update(data.data() + i, sz);
+    }
+    CHECK(s64.digest() == xxh3_64(data));
+    CHECK(primitives::hash::bytes((std::string)xxh3_128(data)).size() == 16);
+    CHECK(xxh3_64(data.data(), data.size(), 1) != xxh3_64(data));
+
+    path fn;
+    write_file(fn = fs::temp_directory_path() / unique_path(), data);
+    CHECK(xxh3_64_file(fn) == xxh3_64(data));
+    CHECK(xxh3_128_file(fn) == xxh3_128(data));
+    CHECK(primitives::hash::xxh3_contents_hash{}(fn) == xxh3_64(data));
+
+    Executor e(2);
+    CHECK(hash_files(e, { fn }, HashType::xxh3_128)[fn] == xxh3_128(data));
+    fs::remove(fn);
+}
+
+TEST_CASE("Benchmarking hashes: throughput", "[.][hash][benchmark]")
+{
+    String data(256 * 1024 * 1024, 1);
+    BENCHMARK("xxh3_64, 256 MB")
+    {
+        return xxh3_64(data);
+    };
+    BENCHMARK("xxh3_128, 256 MB")
+    {
+        return xxh3_128(data);
+    };
+    BENCHMARK("blake2b_512, 256 MB")
+    {
+        return blake2b_512(data);
+    };
+}
+
+static path create_hash_tree(size_t n_small, size_t n_large, FilesOrdered &files)
+{
+    auto dir = fs::temp_directory_path() / unique_path();
+    fs::create_directories(dir);
+    auto add = [&](size_t sz)
+    {
+        String s(sz, 0);
+        for (size_t i = 0; i < sz; i++)
+            s[i] = (char)(i * 31 + files.size());
+        files.push_back(dir / std::to_string(files.size()));
+        write_file(files.back(), s);
+    };
+    for (size_t i = 0; i < n_small; i++)
+        add(i * 97 % 20000);
+    for (size_t i = 0; i < n_large; i++)
+        add(5 * 1024 * 1024 + i);
+    return dir;
+}
+
+TEST_CASE("Checking hashes: many files", "[hash]")
+{
+    FilesOrdered files;
+    auto dir = create_hash_tree(300, 2, files);
+
+    Executor e(4);
+    for (auto t : { HashType::blake2b_512, HashType::sha3_256 })
+    {
+        auto m = hash_files(e, files, t);
+        REQUIRE(m.size() == files.size());
+        for (auto &f : files)
+        {
+            CHECK(m[f] == (t == HashType::blake2b_512
+                ? strong_file_hash_file_blake2b_sha3(f) : strong_file_hash_file_sha3_sha2(f)));
+        }
+    }
+    CHECK(hash_files(e, {}).empty());
+    CHECK_THROWS(hash_files(e, files, HashType::null));
+    CHECK_THROWS(hash_files(e, { dir / "missing" }));
+
+    // tasks pushed before a rejected one finish before the error is thrown
+    {
+        std::atomic_bool go = false;
+        std::atomic_int started = 0;
+        Futures<void> blockers;
+        for (int i = 0; i < 4; i++)
+        {
+            blockers.push_back(e.push([&]
+            {
+                started++;
+                while (!go)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }));
+        }
+        while (started != 4)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        e.set_capacity(1, OverflowPolicy::Reject);
+        std::thread release([&go]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            go = true;
+        });
+        CHECK_THROWS(hash_files(e, files));
+        release.join();
+        e.set_capacity(0);
+        for (auto &f : blockers)
+            f.get();
+    }
+
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Benchmarking hashes: many files", "[.][hash][benchmark]")
+{
+    FilesOrdered files;
+    auto dir = create_hash_tree(20000, 4, files);
+
+    Executor e;
+    BENCHMARK("serial")
+    {
+        size_t n = 0;
+        for (auto &f : files)
+            n += strong_file_hash_file_blake2b_sha3(f).size();
+        return n;
+    };
+    BENCHMARK("hash_files")
+    {
+        return hash_files(e, files).size();
+    };
+
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Checking hashes: merkle", "[hash]")
+{
+    using namespace primitives::hash;
+
+    auto dir = fs::temp_directory_path() / unique_path();
+    fs::create_directories(dir / "a" / "b");
+    auto fn = dir / "a" / "b" / "big";
+    String s(10 * 4096 + 100, 0);
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = (char)(i * 31);
+    write_file(fn, s);
+
+    // file
+    {
+        file_tree t(fn, HashType::xxh3_128, 4096);
+        CHECK(t.chunks() == 11);
+        CHECK(t.levels.size() == 5);
+        CHECK(t.root() == file_tree(fn, HashType::xxh3_128, 4096).root());
+        auto old = t;
+
+        s[5 * 4096 + 1]++;
+        write_file(fn, s);
+        t.update(fn, 5 * 4096 + 1, 1);
+        CHECK(t.root() != old.root());
+        CHECK(t.levels == file_tree(fn, HashType::xxh3_128, 4096).levels);
+        CHECK(t.diff(old) == std::vector<size_t>{ 5 });
+
+        s += String(8000, 'x');
+        write_file(fn, s);
+        t.update(fn, 0, 0);
+        CHECK(t.chunks() == 12);
+        CHECK(t.levels == file_tree(fn, HashType::xxh3_128, 4096).levels);
+
+        s.resize(4096);
+        write_file(fn, s);
+        t.update(fn, 0, 0);
+        CHECK(t.chunks() == 1);
+        CHECK(t.levels == file_tree(fn, HashType::xxh3_128, 4096).levels);
+
+        t.save(dir / "file.manifest");
+        CHECK(file_tree::load(dir / "file.manifest").levels == t.levels);
+        CHECK(file_tree::load(dir / "file.manifest").root() == t.root());
+        fs::remove(dir / "file.manifest");
+
+        write_file(fn, "");
+        t.update(fn, 0, 0);
+        CHECK(t.chunks() == 1);
+        CHECK(t.levels[0][0] == xxh3_128(String(1, 0)));
+        CHECK_THROWS(file_tree(fn, HashType::null));
+    }
+
+    // a chunk made of child hashes does not collide with their parent node
+    for (auto type : { HashType::xxh3_128, HashType::sha3_256, HashType::blake2b_512 })
+    {
+        auto fn2 = dir / "a" / "b" / "forged";
+        write_file(fn, String(4096, 'a') + String(4096, 'b'));
+        file_tree two(fn, type, 4096);
+        REQUIRE(two.chunks() == 2);
+
+        write_file(fn2, two.levels[0][0] + two.levels[0][1]);
+        file_tree one(fn2, type, 4096);
+        REQUIRE(one.chunks() == 1);
+        CHECK(one.root() != two.root());
+        write_file(fn2, (char)1 + two.levels[0][0] + two.levels[0][1]);
+        CHECK(file_tree(fn2, type, 4096).root() != two.root());
+        fs::remove(fn2);
+    }
+
+    // directory
+    {
+        write_file(dir / "1", "1");
+        write_file(dir / "a" / "2 3", "2");
+        dir_tree t(dir, HashType::blake2b_512, 4096);
+        CHECK(t.files.size() == 3);
+        CHECK(t.dirs.size() == 3);
+        auto manifest = dir.parent_path() / (dir.filename().string() + ".manifest");
+        t.save(manifest);
+
+        auto t2 = dir_tree::load(manifest, dir);
+        CHECK(t2.files == t.files);
+        CHECK(t2.root() == t.root());
+        CHECK(t2.update().empty());
+
+        write_file(dir / "a" / "2 3", "22");
+        write_file(dir / "a" / "b" / "4", "4");
+        fs::remove(dir / "1");
+        CHECK(t2.update() == FilesSorted{ "1", "a/2 3", "a/b/4" });
+        CHECK(t2.root() != t.root());
+        CHECK(t2.root() == dir_tree(dir, HashType::blake2b_512, 4096).root());
+        CHECK(t2.dirs[""] == t2.root());
+        CHECK(t2.dirs["a/b"] != t.dirs["a/b"]);
+        CHECK(t2.diff(t) == FilesSorted{ "1", "a/2 3", "a/b/4" });
+        CHECK(t.diff(t).empty());
+
+        fs::remove(manifest);
+    }
+
+    fs::remove_all(dir);
 }
 
 TEST_CASE("Checking filesystem & command2", "[fs,cmd]")
@@ -614,52 +926,1780 @@ TEST_CASE("Checking executor: test fast wait", "[executor]")
     CHECK(i == 1);
 }
 
-TEST_CASE("Checking templates", "[templates]")
+TEST_CASE("Checking executor: wait latency", "[executor]")
 {
+    using namespace std::literals::chrono_literals;
+
+    // external waiter
     {
-        int i = 0;
-        auto f = [&]()
+        Executor e(2);
+        for (int i = 0; i < 20; i++)
         {
-            RUN_ONCE
-            {
-                i++;
-            }
-        };
+            auto f = e.push([] { std::this_thread::sleep_for(1ms); });
+            REQUIRE_NOTHROW_TIME(f.get(), 50ms);
+        }
+    }
 
-        CHECK(i == 0);
-        f();
-        CHECK(i == 1);
-        f();
-        CHECK(i == 1);
-        f();
-        CHECK(i == 1);
+    // waiter inside executor
+    {
+        Executor e(2);
+        auto f = e.push([&e]
+        {
+            auto f = e.push([] { std::this_thread::sleep_for(1ms); return 5; });
+            return f.get();
+        });
+        int v = 0;
+        REQUIRE_NOTHROW_TIME(v = f.get(), 50ms);
+        CHECK(v == 5);
     }
 
+    // stop wakes waiters of tasks that will never run
     {
-        int i = 0;
-        auto f = [&]()
+        Executor e(1);
+        std::atomic_bool go = false;
+        e.push([&go] { while (!go) std::this_thread::sleep_for(1ms); });
+        auto f = e.push([] {});
+        std::thread t([&] { std::this_thread::sleep_for(50ms); e.stop(); go = true; });
+        REQUIRE_NOTHROW_TIME(f.wait(), 500ms);
+        t.join();
+    }
+}
+
+// count all allocations in this test program
+static std::atomic_size_t n_allocations;
+
+void *operator new(size_t sz)
+{
+    ++n_allocations;
+    if (auto p = malloc(sz ? sz : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+TEST_CASE("Checking executor: allocations", "[executor]")
+{
+    // small callables are stored inline
+    {
+        int a = 0;
+        auto n = n_allocations.load();
+        Task t([&a] { a++; });
+        auto t2 = std::move(t);
+        t2();
+        CHECK(n_allocations == n);
+        CHECK(a == 1);
+        CHECK_FALSE(t);
+    }
+
+    // big ones go to the heap
+    {
+        std::array<char, Task::inline_size * 2> big{};
+        auto n = n_allocations.load();
+        Task t([big] { (void)big; });
+        auto t2 = std::move(t);
+        t2();
+        CHECK(n_allocations == n + 1);
+    }
+
+    // callable, arguments and shared state are allocated together
+    {
+        Executor e(1);
+        for (int i = 0; i < 1000; i++)
+            e.push([] {});
+        e.wait();
+
+        const int N = 1000;
+        auto n = n_allocations.load();
+        for (int i = 0; i < N; i++)
+            e.push([i] { return i; });
+        e.wait();
+        CHECK(n_allocations - n <= N);
+
+        auto f = e.push([](int a, int b) { return a + b; }, 2, 3);
+        CHECK(f.get() == 5);
+    }
+}
+
+TEST_CASE("Checking executor: work stealing queue", "[executor]")
+{
+    {
+        WorkStealingQueue<int> q(2);
+        for (int i = 0; i < 10; i++)
+            q.push(i);
+        CHECK(q.size() == 10);
+
+        int v;
+        REQUIRE(q.steal(v));
+        CHECK(v == 0); // fifo for thieves
+        REQUIRE(q.pop(v));
+        CHECK(v == 9); // lifo for owner
+        REQUIRE(q.steal(v));
+        CHECK(v == 1);
+        while (q.pop(v))
+            ;
+        CHECK(q.empty());
+        CHECK_FALSE(q.steal(v));
+    }
+
+    // every element is taken exactly once
+    {
+        const int n = 100000;
+        WorkStealingQueue<int> q;
+        std::vector<std::atomic_int> taken(n);
+        std::atomic_bool done = false;
+        std::vector<std::thread> thieves;
+        for (int i = 0; i < 3; i++)
         {
-            RUN_ONCE_FOR_THREAD
+            thieves.emplace_back([&]
             {
-                i++;
-            }
-        };
+                int v;
+                while (!done || !q.empty())
+                {
+                    if (q.steal(v))
+                        taken[v]++;
+                }
+            });
+        }
+        int v;
+        for (int i = 0; i < n; i++)
+        {
+            q.push(i);
+            if (i % 3 == 0 && q.pop(v))
+                taken[v]++;
+        }
+        while (q.pop(v))
+            taken[v]++;
+        done = true;
+        for (auto &t : thieves)
+            t.join();
+        CHECK(std::all_of(taken.begin(), taken.end(), [](auto &v) { return v == 1; }));
+    }
 
-        CHECK(i == 0);
-        f();
-        CHECK(i == 1);
-        f();
-        CHECK(i == 1);
-        f();
-        CHECK(i == 1);
+    // nested pushes go to worker deques and are stolen by others
+    {
+        std::atomic_int v = 0;
+        Executor e(4);
+        Futures<void> fs;
+        for (int i = 0; i < 10; i++)
+        {
+            fs.push_back(e.push([&e, &v]
+            {
+                Futures<void> fs;
+                for (int i = 0; i < 100; i++)
+                    fs.push_back(e.push([&v] { v++; }));
+                for (auto &f : fs)
+                    f.get();
+            }));
+        }
+        for (auto &f : fs)
+            f.get();
+        CHECK(v == 1000);
+        e.wait();
+        CHECK(e.empty());
+    }
 
-        std::thread([&] {f(); f(); f(); }).join();
-        CHECK(i == 2);
-        std::thread([&] {f(); f(); f(); }).join();
-        CHECK(i == 3);
-        std::thread([&] {f(); f(); f(); }).join();
-        CHECK(i == 4);
+    // outside threads steal from worker deques
+    {
+        std::atomic_int v = 0;
+        std::atomic_bool started = false, release = false;
+        Executor e(1);
+        e.push([&]
+        {
+            started = true;
+            for (int i = 0; i < 100; i++)
+                e.push([&v] { v++; });
+            while (!release)
+                std::this_thread::yield();
+        });
+        while (!started)
+            std::this_thread::yield();
+        int ran = 0;
+        while (v < 100)
+        {
+            if (e.try_run_one())
+                ran++;
+        }
+        release = true;
+        e.wait();
+        CHECK(ran == 100);
+    }
+}
+
+TEST_CASE("Checking executor: parallel algorithms", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(4);
+
+    {
+        std::vector<int> v(10000);
+        parallel_for(e, v, 0, [](int &i) { i++; });
+        CHECK(std::all_of(v.begin(), v.end(), [](auto i) { return i == 1; }));
+        parallel_for(e, v, 1, [](int &i) { i++; });
+        CHECK(std::all_of(v.begin(), v.end(), [](auto i) { return i == 2; }));
+        parallel_for(e, std::vector<int>{}, 0, [](int &i) { i++; });
+    }
+
+    // uneven workload
+    {
+        std::atomic_int n = 0;
+        parallel_for(e, std::views::iota(0, 100), 1, [&n](int i)
+        {
+            if (i % 10 == 0)
+                std::this_thread::sleep_for(10ms);
+            n++;
+        });
+        CHECK(n == 100);
+    }
+
+    {
+        std::vector<int> v(10000);
+        std::iota(v.begin(), v.end(), 0);
+        CHECK(parallel_reduce(e, v, 0, 0LL, std::plus<>{}) == std::accumulate(v.begin(), v.end(), 0LL));
+        CHECK(parallel_reduce(e, v, 7, 5LL, std::plus<>{}) == std::accumulate(v.begin(), v.end(), 5LL));
+        CHECK(parallel_transform_reduce(e, v, 0, 0LL, std::plus<>{}, [](int i) { return (long long)i * i; })
+            == std::transform_reduce(v.begin(), v.end(), 0LL, std::plus<>{}, [](int i) { return (long long)i * i; }));
+        CHECK(parallel_reduce(e, std::vector<int>{}, 0, 42, std::plus<>{}) == 42);
+
+        // order is kept
+        std::vector<std::string> s{ "a", "b", "c", "d", "e", "f", "g" };
+        CHECK(parallel_reduce(e, s, 1, ""s, std::plus<>{}) == "abcdefg");
+    }
+
+    // nested
+    {
+        std::atomic_int n = 0;
+        parallel_for(e, std::views::iota(0, 10), 1, [&](int)
+        {
+            parallel_for(e, std::views::iota(0, 100), 0, [&n](int) { n++; });
+        });
+        CHECK(n == 1000);
+    }
+
+    {
+        std::atomic_int n = 0;
+        CHECK_THROWS(parallel_for(e, std::views::iota(0, 100), 1, [&n](int i)
+        {
+            n++;
+            if (i == 50)
+                throw std::runtime_error("50");
+        }));
+        CHECK_THROWS(parallel_transform_reduce(e, std::views::iota(0, 100), 1, 0, std::plus<>{}, [](int i)
+        {
+            if (i == 50)
+                throw std::runtime_error("50");
+            return i;
+        }));
+    }
+}
+
+TEST_CASE("Checking executor: coroutines", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+    using primitives::coro::Task;
+
+    // one worker: awaiting must not block it
+    Executor e(1);
+
+    auto add = [](int a, int b) -> Task<int> { co_return a + b; };
+    auto f = [&]() -> Task<int>
+    {
+        auto v = co_await add(1, 2);
+        co_await e.schedule();
+        auto in_executor = e.is_in_executor();
+        // task is queued behind us on the same worker
+        v += co_await e.push([] { std::this_thread::sleep_for(10ms); return 5; });
+        co_return in_executor ? v : -1;
+    };
+    CHECK(primitives::coro::spawn(e, f()).get() == 8);
+
+    // lazy start
+    {
+        bool started = false;
+        auto g = [&]() -> Task<> { started = true; co_return; };
+        auto t = g();
+        CHECK_FALSE(started);
+        primitives::coro::spawn(e, std::move(t)).get();
+        CHECK(started);
+    }
+
+    // exceptions
+    {
+        auto g = []() -> Task<int> { throw std::runtime_error("x"); co_return 1; };
+        auto h = [&]() -> Task<int> { co_return co_await g() + 1; };
+        CHECK_THROWS(primitives::coro::spawn(e, h()).get());
+        auto k = [&]() -> Task<> { co_await e.push([] { throw std::runtime_error("x"); }); };
+        CHECK_THROWS(primitives::coro::spawn(e, k()).get());
+    }
+
+    // many suspended coroutines on a single worker
+    {
+        std::atomic_int n = 0;
+        auto f = e.push([] { std::this_thread::sleep_for(10ms); });
+        auto g = [&]() -> Task<> { co_await f; n++; };
+        Futures<void> fs;
+        for (int i = 0; i < 100; i++)
+            fs.push_back(primitives::coro::spawn(e, g()));
+        for (auto &f : fs)
+            f.get();
+        CHECK(n == 100);
+    }
+
+    // then() callback must not refer to the future object
+    {
+        auto f2 = [&]
+        {
+            auto f = e.push([] { std::this_thread::sleep_for(10ms); return 1; });
+            return f.then([] { return 2; });
+        }();
+        CHECK(f2.get() == 2);
+    }
+}
+
+TEST_CASE("Checking executor: priorities and affinity", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    {
+        Executor e(1);
+        std::atomic_bool go = false;
+        e.push([&go] { while (!go) std::this_thread::sleep_for(1ms); });
+
+        std::mutex m;
+        std::string order;
+        auto add = [&](char c) { return [&, c] { std::unique_lock lk(m); order += c; }; };
+        Futures<void> fs;
+        fs.push_back(e.push(TaskPriority::Low, add('l')));
+        fs.push_back(e.push(add('n')));
+        fs.push_back(e.push(TaskPriority::High, add('h')));
+        fs.push_back(e.push(TaskOptions{ TaskPriority::Low, 0 }, add('p')));
+        fs.push_back(e.push(TaskPriority::Normal, add('n')));
+        fs.push_back(e.push(TaskPriority::High, add('h')));
+        go = true;
+        for (auto &f : fs)
+            f.get();
+        CHECK(order == "hhnnpl");
+    }
+
+    // pinned tasks run on their worker only
+    for (bool pin : { false, true })
+    {
+        Executor e(4, "", pin);
+        std::vector<Future<std::thread::id>> fs;
+        for (int i = 0; i < 20; i++)
+            fs.push_back(e.push(TaskOptions{ .worker = 2 }, [] { return std::this_thread::get_id(); }));
+        auto id = fs[0].get();
+        CHECK(std::all_of(fs.begin(), fs.end(), [&id](auto &f) { return f.get() == id; }));
+        CHECK_THROWS(e.push(TaskOptions{ .worker = 4 }, [] {}));
+
+        // unknown numa node falls back to any worker
+        CHECK(e.push(TaskOptions{ .numa_node = 1000 }, [] { return 5; }).get() == 5);
+
+        // numa tasks are not stuck behind a busy worker of the node
+        std::atomic_bool release = false;
+        auto busy = e.push(TaskOptions{ .worker = 0 }, [&release]
+        {
+            while (!release)
+                std::this_thread::sleep_for(1ms);
+        });
+        Futures<int> nfs;
+        for (int i = 0; i < 20; i++)
+            nfs.push_back(e.push(TaskOptions{ .numa_node = 0 }, [i] { return i; }));
+        for (int i = 0; i < 20; i++)
+            CHECK(nfs[i].get() == i);
+        release = true;
+        busy.get();
+    }
+}
+
+TEST_CASE("Checking executor: metrics", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(2);
+    Futures<void> fs;
+    for (int i = 0; i < 100; i++)
+        fs.push_back(e.push([] { std::this_thread::sleep_for(100us); }));
+    for (auto &f : fs)
+        f.get();
+    e.wait();
+
+    auto m = e.metrics();
+    REQUIRE(m.workers.size() == 2);
+    uint64_t n = 0, runs = 0, waits = 0, busy = 0, high_water = 0;
+    for (auto &w : m.workers)
+    {
+        n += w.tasks_executed;
+        runs += std::accumulate(w.run_time_ns.begin(), w.run_time_ns.end(), 0ULL);
+        waits += std::accumulate(w.queue_wait_ns.begin(), w.queue_wait_ns.end(), 0ULL);
+        busy += w.busy_ns;
+        high_water = std::max(high_water, w.queue_high_water);
+    }
+    CHECK(n == 100);
+    CHECK(runs == 100);
+    CHECK(waits == 100);
+    CHECK(busy >= 100 * 100'000);
+    CHECK(high_water > 0);
+
+    auto j = m.to_json();
+    CHECK(j.starts_with("{\"workers\":[{\"id\":0,\"tasks_executed\":"));
+    CHECK(j.find("\"run_time_ns\":[") != j.npos);
+    CHECK(j.ends_with("]}]}"));
+}
+
+TEST_CASE("Checking executor: combinators", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(2);
+
+    {
+        Futures<int> fs;
+        for (int i = 0; i < 1000; i++)
+            fs.push_back(e.push([i] { return i; }));
+        // same future twice
+        fs.push_back(fs.back());
+        whenAll(e, fs).get();
+        CHECK(std::all_of(fs.begin(), fs.end(), [](auto &f) { return f.state->set.load(); }));
+        auto i = whenAny(e, fs).get();
+        CHECK(fs[i].state->set);
     }
+
+    {
+        std::vector<SharedStatePtr<void>> ss;
+        Futures<void> fs;
+        for (int i = 0; i < 10; i++)
+            fs.push_back(ss.emplace_back(makeSharedState<void>(e))->getFuture());
+        auto all = whenAll(e, fs);
+        auto any = whenAny(e, fs);
+        ss[7]->setExecuted();
+        CHECK(any.get() == 7);
+        CHECK_FALSE(all.state->set);
+        for (auto &s : ss)
+            s->setExecuted();
+        all.get();
+    }
+
+    // combinator futures may be dropped before inputs are set
+    {
+        std::atomic_bool go = false;
+        auto f = e.push([&go] { while (!go) std::this_thread::sleep_for(1ms); });
+        whenAll(e, f);
+        whenAny(e, f);
+        go = true;
+        f.get();
+    }
+
+    // inputs may be destroyed unset
+    {
+        Future<void> all = whenAll(e, makeSharedState<void>(e)->getFuture());
+        CHECK_FALSE(all.state->set);
+    }
+}
+
+TEST_CASE("Checking executor: bounded queues", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(1);
+    std::atomic_bool started, go;
+    auto block = [&]
+    {
+        started = go = false;
+        e.push([&] { started = true; while (!go) std::this_thread::sleep_for(1ms); });
+        while (!started)
+            std::this_thread::sleep_for(1ms);
+    };
+
+    {
+        block();
+        e.set_capacity(2, OverflowPolicy::Reject);
+        e.push([] {});
+        CHECK(e.try_push([] { return 1; }));
+        CHECK(e.saturated());
+        CHECK_THROWS(e.push([] {}));
+        CHECK_FALSE(e.try_push([] { return 1; }));
+        go = true;
+        e.wait();
+        CHECK(e.try_push([] { return 1; })->get() == 1);
+    }
+
+    {
+        block();
+        e.set_capacity(1, OverflowPolicy::RunInCaller);
+        auto f1 = e.push([] { return std::this_thread::get_id(); });
+        auto f2 = e.push([] { return std::this_thread::get_id(); });
+        CHECK(f2.get() == std::this_thread::get_id());
+        go = true;
+        CHECK(f1.get() != std::this_thread::get_id());
+    }
+
+    {
+        block();
+        e.set_capacity(4, OverflowPolicy::Block);
+        std::atomic_int pushed = 0, done = 0;
+        std::thread producer([&]
+        {
+            for (int i = 0; i < 100; i++, pushed++)
+                e.push([&done] { done++; });
+        });
+        std::this_thread::sleep_for(50ms);
+        CHECK(pushed == 4);
+        go = true;
+        producer.join();
+        e.wait();
+        CHECK(done == 100);
+    }
+
+    // try_push neither blocks nor throws when producers race for the last slots
+    for (auto policy : { OverflowPolicy::Reject, OverflowPolicy::Block })
+    {
+        block();
+        e.set_capacity(2, policy);
+        std::atomic_int accepted = 0, errors = 0, finished = 0, done = 0;
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 8; t++)
+        {
+            producers.emplace_back([&]
+            {
+                for (int i = 0; i < 1000; i++)
+                {
+                    try
+                    {
+                        if (e.try_push([&done] { done++; }))
+                            accepted++;
+                    }
+                    catch (...)
+                    {
+                        errors++;
+                    }
+                }
+                finished++;
+            });
+        }
+        for (int i = 0; i < 5000 && finished != 8; i++)
+            std::this_thread::sleep_for(1ms);
+        CHECK(finished == 8);
+        CHECK(errors == 0);
+        CHECK(accepted >= 2);
+        go = true;
+        for (auto &t : producers)
+            t.join();
+        e.wait();
+        CHECK(done == accepted);
+    }
+
+    // blocked producers are released on stop
+    {
+        block();
+        std::thread producer([&]
+        {
+            for (int i = 0; i < 10; i++)
+                e.push([] {});
+        });
+        std::this_thread::sleep_for(10ms);
+        e.stop();
+        producer.join();
+        go = true;
+    }
+}
+
+TEST_CASE("Checking executor: elastic", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(2, "", false, 4);
+    e.set_idle_timeout(100ms);
+    CHECK(e.numberOfRunningThreads() == 2);
+
+    std::atomic_bool go = false;
+    std::atomic_int blocked = 0;
+    auto block = [&]
+    {
+        primitives::ScopedBlockingRegion br;
+        // nested regions are counted once
+        primitives::ScopedBlockingRegion br2;
+        blocked++;
+        while (!go)
+            std::this_thread::sleep_for(1ms);
+    };
+    Futures<void> fs;
+    for (int i = 0; i < 2; i++)
+        fs.push_back(e.push([&block] { block(); }));
+    while (blocked != 2)
+        std::this_thread::sleep_for(1ms);
+
+    // all workers are blocked, but the pool is still alive
+    int v = 0;
+    REQUIRE_NOTHROW_TIME(v = e.push([] { return 5; }).get(), 1s);
+    CHECK(v == 5);
+
+    // hard cap
+    for (int i = 0; i < 4; i++)
+        fs.push_back(e.push([&block] { block(); }));
+    while (blocked != 4)
+        std::this_thread::sleep_for(1ms);
+    std::this_thread::sleep_for(50ms);
+    CHECK(blocked == 4);
+    CHECK(e.numberOfRunningThreads() == 4);
+
+    go = true;
+    for (auto &f : fs)
+        f.get();
+
+    // extra workers stop when idle
+    for (int i = 0; i < 100 && e.numberOfRunningThreads() != 2; i++)
+        std::this_thread::sleep_for(10ms);
+    CHECK(e.numberOfRunningThreads() == 2);
+
+    // and start again
+    go = false;
+    blocked = 0;
+    for (int i = 0; i < 3; i++)
+        fs.push_back(e.push([&block] { block(); }));
+    while (blocked != 3)
+        std::this_thread::sleep_for(1ms);
+    // a spare one is started when all are blocked
+    CHECK(e.numberOfRunningThreads() == 4);
+    go = true;
+}
+
+TEST_CASE("Checking executor: timers", "[executor]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e(2);
+
+    auto start = std::chrono::steady_clock::now();
+    auto f = e.push_after(20ms, [] { return 5; });
+    CHECK(f.get() == 5);
+    CHECK(std::chrono::steady_clock::now() - start >= 20ms);
+    // already fired
+    CHECK_FALSE(f.cancel());
+
+    // other clocks and far timers, which are cascaded through the levels
+    CHECK(e.push_at(std::chrono::system_clock::now() + 10ms, [] { return 1; }).get() == 1);
+    start = std::chrono::steady_clock::now();
+    e.push_after(300ms, [] {}).get();
+    CHECK(std::chrono::steady_clock::now() - start >= 300ms);
+
+    // never before the deadline
+    std::atomic_int early = 0;
+    Futures<void> fs;
+    TaskOptions o;
+    o.priority = TaskPriority::High;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++)
+    {
+        auto d = std::chrono::milliseconds(i * 7 % 50);
+        fs.push_back(e.push_after(d, o, [&early, start, d]
+        {
+            if (std::chrono::steady_clock::now() - start < d)
+                early++;
+        }));
+    }
+    for (auto &f : fs)
+        f.get();
+    CHECK(early == 0);
+
+    // cancel
+    std::atomic_bool ran = false;
+    auto c = e.push_after(50ms, [&ran] { ran = true; });
+    CHECK(c.cancel());
+    CHECK_FALSE(c.cancel());
+    CHECK_THROWS(c.get());
+    std::this_thread::sleep_for(70ms);
+    CHECK_FALSE(ran);
+
+    // pending timers are cancelled on stop
+    auto p = e.push_after(1h, [] {});
+    e.join();
+    CHECK_THROWS(p.get());
+}
+
+TEST_CASE("Checking cron", "[cron]")
+{
+    using namespace std::literals::chrono_literals;
+
+    // tasks run in the caller of push(), that is the cron thread
+    struct inline_executor
+    {
+        void push(std::function<void()> &&f) { f(); }
+    };
+
+    Executor e(2);
+    inline_executor ie;
+    auto check = [](Cron &cr)
+    {
+        std::atomic_int n = 0;
+        auto now = Cron::Clock::now();
+        cr.push(now + 50ms, [&n] { n++; }, {}, 0);
+        // same time point twice
+        cr.push(now + 50ms, [&n] { n++; }, {}, 0);
+        // in the past
+        cr.push(now - 1s, [&n] { n++; }, {}, 0);
+        // the first tick is skipped by default
+        cr.push(now, [&n] { n += 100; });
+        for (int i = 0; i < 1000 && n < 3; i++)
+            std::this_thread::sleep_for(1ms);
+        std::this_thread::sleep_for(50ms);
+        CHECK(n == 3);
+    };
+
+    // executor timer wheel
+    {
+        Cron cr(e);
+        check(cr);
+    }
+    // own thread
+    {
+        Cron cr(e, true);
+        check(cr);
+    }
+    // other executors
+    {
+        Cron cr(ie);
+        check(cr);
+    }
+}
+
+TEST_CASE("Checking cron: cancel, drift and coalesce", "[cron]")
+{
+    using namespace std::literals::chrono_literals;
+
+    // ticks stay on the grid of the start however late they are handled
+    {
+        Cron::CronTask::Repeat r(0, 0, 0, 1);
+        auto start = Cron::Clock::now();
+        auto t = start;
+        for (int i = 0; i < 1000; i++)
+            t = r.next_repeat(start, t + std::chrono::milliseconds(i * 37 % 900));
+        CHECK(t == start + 1000s);
+        CHECK(r.next_repeat(start, start - 1s) == start);
+        // missed ticks are not made up
+        CHECK(r.next_repeat(start, start + 5500ms) == start + 6s);
+    }
+
+    Executor e(4);
+    for (bool own_thread : { false, true })
+    {
+        std::atomic_int n = 0, m = 0, c = 0, running = 0, overlap = 0;
+        std::mutex tm;
+        std::vector<Cron::TimePoint> ticks;
+        auto start = Cron::Clock::now() + 10ms;
+        {
+            Cron cr(e, own_thread);
+
+            // cancel before the first run
+            auto h1 = cr.push(start + 300ms, [&n] { n++; }, {}, 0);
+            CHECK(h1.cancel());
+            CHECK_FALSE(h1.cancel());
+            CHECK(h1.cancelled());
+
+            // cancel between runs
+            auto h2 = cr.push(start, [&m] { m++; }, Cron::CronTask::Repeat(0, 0, 0, 1), 0);
+
+            // slow task does not shift the next ticks
+            cr.push(start, [&]
+            {
+                {
+                    std::lock_guard lk(tm);
+                    ticks.push_back(Cron::Clock::now());
+                }
+                std::this_thread::sleep_for(100ms);
+            }, Cron::CronTask::Repeat(0, 0, 0, 1), 0);
+
+            // ticks while the previous one runs are skipped
+            Cron::CronTask ct;
+            ct.task = [&]
+            {
+                if (running++)
+                    overlap++;
+                c++;
+                std::this_thread::sleep_for(1500ms);
+                running--;
+            };
+            ct.repeat = Cron::CronTask::Repeat(0, 0, 0, 1);
+            ct.skip = 0;
+            ct.coalesce = true;
+            cr.push(start, ct);
+
+            while (m < 2)
+                std::this_thread::sleep_for(1ms);
+            CHECK(h2.cancel());
+            std::this_thread::sleep_until(start + 3300ms);
+        }
+        e.wait();
+
+        CHECK(n == 0);
+        CHECK(m == 2);
+        // ticks 0, 1 (skipped), 2, 3 (skipped)
+        CHECK(c == 2);
+        CHECK(overlap == 0);
+        REQUIRE(ticks.size() == 4);
+        for (int i = 0; i < 4; i++)
+        {
+            auto d = ticks[i] - (start + i * 1s);
+            CHECK(d > -5ms);
+            CHECK(d < 200ms);
+        }
+    }
+}
+
+TEST_CASE("Benchmarking executor: timers", "[.][executor][benchmark]")
+{
+    using namespace std::literals::chrono_literals;
+
+    Executor e;
+    const int n = 100000;
+    BENCHMARK("push_after and cancel 100k")
+    {
+        std::vector<DelayedFuture<void>> fs;
+        fs.reserve(n);
+        for (int i = 0; i < n; i++)
+            fs.push_back(e.push_after(std::chrono::milliseconds(1000 + i % 60000), [] {}));
+        for (auto &f : fs)
+            f.cancel();
+        return fs.size();
+    };
+}
+
+TEST_CASE("Benchmarking executor: parallel algorithms scaling", "[.][executor][benchmark]")
+{
+    std::vector<double> v(1 << 22);
+    std::iota(v.begin(), v.end(), 0.0);
+
+    for (size_t n = 1; n <= std::thread::hardware_concurrency(); n *= 2)
+    {
+        Executor e(n);
+        BENCHMARK("cpu bound, threads: " + std::to_string(n))
+        {
+            return parallel_transform_reduce(e, std::views::iota(0, 1 << 16), 0, 0.0, std::plus<>{}, [](int i)
+            {
+                double x = i;
+                for (int j = 0; j < 100; j++)
+                    x = std::sqrt(x + j);
+                return x;
+            });
+        };
+        BENCHMARK("memory bound, threads: " + std::to_string(n))
+        {
+            parallel_for(e, v, 0, [](double &d) { d = d * 2 + 1; });
+            return parallel_reduce(e, v, 0, 0.0, std::plus<>{});
+        };
+    }
+}
+
+TEST_CASE("Benchmarking executor: priority tail latency", "[.][executor][benchmark]")
+{
+    using namespace std::literals::chrono_literals;
+    using clock = std::chrono::steady_clock;
+
+    auto spin = [](auto d)
+    {
+        auto t = clock::now();
+        while (clock::now() - t < d)
+            ;
+    };
+
+    for (auto p : { TaskPriority::Normal, TaskPriority::High })
+    {
+        Executor e;
+        std::atomic_bool stop = false;
+
+        // saturate all workers with background jobs
+        std::thread bg([&]
+        {
+            while (!stop)
+            {
+                for (size_t i = 0; i < e.numberOfThreads() * 4; i++)
+                    e.push(TaskPriority::Normal, [&spin] { spin(200us); });
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+
+        std::vector<double> lat;
+        for (int i = 0; i < 1000; i++)
+        {
+            auto start = clock::now();
+            auto f = e.push(p, [start] { return std::chrono::duration<double, std::micro>(clock::now() - start).count(); });
+            lat.push_back(f.get());
+        }
+        stop = true;
+        bg.join();
+        e.stop();
+
+        std::sort(lat.begin(), lat.end());
+        std::cout << "priority " << (p == TaskPriority::High ? "high" : "normal") << ", latency us:"
+            << " p50 = " << lat[lat.size() / 2]
+            << " p99 = " << lat[lat.size() * 99 / 100]
+            << " max = " << lat.back() << std::endl;
+    }
+}
+
+TEST_CASE("Benchmarking executor: combinators", "[.][executor][benchmark]")
+{
+    Executor e(1);
+    auto make = [&e]
+    {
+        Futures<void> fs;
+        for (int i = 0; i < 100'000; i++)
+            fs.push_back(makeSharedState<void>(e)->getFuture());
+        return fs;
+    };
+
+    BENCHMARK_ADVANCED("whenAll, 100k futures")(Catch::Benchmark::Chronometer meter)
+    {
+        auto fs = make();
+        meter.measure([&] { return whenAll(e, fs); });
+    };
+    BENCHMARK_ADVANCED("whenAny, 100k futures")(Catch::Benchmark::Chronometer meter)
+    {
+        auto fs = make();
+        meter.measure([&] { return whenAny(e, fs); });
+    };
+}
+
+TEST_CASE("Benchmarking executor queues", "[.][executor][benchmark]")
+{
+    const auto nthreads = std::max<size_t>(4, std::thread::hardware_concurrency());
+    const int n = 10000;
+
+    // each thread pushes and pops its own tasks, stealing from others when empty
+    BENCHMARK("TaskQueue (mutex)")
+    {
+        std::vector<TaskQueue> qs(nthreads);
+        std::atomic<size_t> v = 0;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nthreads; i++)
+        {
+            threads.emplace_back([&, i]
+            {
+                std::atomic_bool busy;
+                Task t;
+                for (int j = 0; j < n; j++)
+                    qs[i].push([&v] { v++; });
+                for (size_t k = 0; v < n * nthreads; k++)
+                {
+                    if (qs[(i + k) % nthreads].try_pop(t, busy))
+                        t();
+                }
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+        return v.load();
+    };
+
+    BENCHMARK("WorkStealingQueue (lock-free)")
+    {
+        std::vector<std::unique_ptr<WorkStealingQueue<Task *>>> qs;
+        for (size_t i = 0; i < nthreads; i++)
+            qs.emplace_back(std::make_unique<WorkStealingQueue<Task *>>());
+        std::atomic<size_t> v = 0;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nthreads; i++)
+        {
+            threads.emplace_back([&, i]
+            {
+                Task *t;
+                for (int j = 0; j < n; j++)
+                    qs[i]->push(new Task([&v] { v++; }));
+                for (size_t k = 0; v < n * nthreads; k++)
+                {
+                    if (k == 0 ? qs[i]->pop(t) : qs[(i + k) % nthreads]->steal(t))
+                    {
+                        (*t)();
+                        delete t;
+                        k = -1;
+                    }
+                }
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+        return v.load();
+    };
+
+    size_t allocations = 0;
+    BENCHMARK("Executor: push small lambdas")
+    {
+        Executor e(nthreads);
+        auto a0 = n_allocations.load();
+        for (int i = 0; i < n; i++)
+            e.push([i] { return i; });
+        e.wait();
+        allocations = n_allocations - a0;
+    };
+    // one shared state per push, queues grow rarely
+    CHECK(allocations <= 2 * n);
+
+    BENCHMARK("Executor: nested pushes")
+    {
+        std::atomic_int v = 0;
+        Executor e(nthreads);
+        Futures<void> fs;
+        for (size_t i = 0; i < nthreads; i++)
+        {
+            fs.push_back(e.push([&e, &v, n]
+            {
+                Futures<void> fs;
+                for (int i = 0; i < n / 10; i++)
+                    fs.push_back(e.push([&v] { v++; }));
+                for (auto &f : fs)
+                    f.get();
+            }));
+        }
+        for (auto &f : fs)
+            f.get();
+        return v.load();
+    };
+}
+
+TEST_CASE("Checking templates", "[templates]")
+{
+    {
+        int i = 0;
+        auto f = [&]()
+        {
+            RUN_ONCE
+            {
+                i++;
+            }
+        };
+
+        CHECK(i == 0);
+        f();
+        CHECK(i == 1);
+        f();
+        CHECK(i == 1);
+        f();
+        CHECK(i == 1);
+    }
+
+    {
+        int i = 0;
+        auto f = [&]()
+        {
+            RUN_ONCE_FOR_THREAD
+            {
+                i++;
+            }
+        };
+
+        CHECK(i == 0);
+        f();
+        CHECK(i == 1);
+        f();
+        CHECK(i == 1);
+        f();
+        CHECK(i == 1);
+
+        std::thread([&] {f(); f(); f(); }).join();
+        CHECK(i == 2);
+        std::thread([&] {f(); f(); f(); }).join();
+        CHECK(i == 3);
+        std::thread([&] {f(); f(); f(); }).join();
+        CHECK(i == 4);
+    }
+}
+
+TEST_CASE("Checking crc32", "[crc32]")
+{
+    using namespace primitives::templates2;
+
+    // check values of "123456789"
+    CHECK(crc32_ieee::compute("123456789", 9) == 0xcbf43926);
+    CHECK(crc32c::compute("123456789", 9) == 0xe3069283);
+    CHECK(crc32_mpeg2::compute("123456789", 9) == 0x0376e6e7);
+    CHECK(crc32((const unsigned char *)"123456789", 9) == 0x0376e6e7);
+    CHECK(crc32_ieee::compute("", 0) == 0);
+
+    String data(100000, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 131 + (i >> 7));
+
+    auto check = [&]<class E>(E)
+    {
+        for (size_t off : {0, 1, 7})
+        {
+            for (size_t n : {0, 1, 15, 63, 64, 65, 255, 256, 1000, 4097, 99990})
+            {
+                auto p = data.data() + off;
+                auto r = E::template update_slicing<1>(0x12345678, p, n);
+                CHECK(E::template update_slicing<8>(0x12345678, p, n) == r);
+                CHECK(E::template update_slicing<16>(0x12345678, p, n) == r);
+                CHECK(E::update(0x12345678, p, n) == r);
+#ifdef PRIMITIVES_X86
+                if (cpu_features::get().pclmul)
+                    CHECK(E::update_pclmul(0x12345678, p, n) == r);
+#endif
+
+                auto k = n / 3;
+                CHECK(E::combine(E::compute(p, k), E::compute(p + k, n - k), n - k) == E::compute(p, n));
+
+                typename E::stream s;
+                s.update(p, k);
+                s.update(p + k, n - k);
+                CHECK(s.digest() == E::compute(p, n));
+            }
+        }
+    };
+    check(crc32_mpeg2{});
+    check(crc32_ieee{});
+    check(crc32c{});
+#ifdef PRIMITIVES_X86
+    if (cpu_features::get().sse42)
+        CHECK(crc32c::update_sse42(~0u, data.data(), data.size()) == crc32c::update_slicing<1>(~0u, data.data(), data.size()));
+#endif
+}
+
+TEST_CASE("Benchmarking crc32", "[.][crc32][benchmark]")
+{
+    using namespace primitives::templates2;
+
+    String data(64 * 1024 * 1024, 1);
+    BENCHMARK("ieee, slicing-by-1, 64 MB")
+    {
+        return crc32_ieee::update_slicing<1>(0, data.data(), data.size());
+    };
+    BENCHMARK("ieee, slicing-by-8, 64 MB")
+    {
+        return crc32_ieee::update_slicing<8>(0, data.data(), data.size());
+    };
+    BENCHMARK("ieee, slicing-by-16, 64 MB")
+    {
+        return crc32_ieee::update_slicing<16>(0, data.data(), data.size());
+    };
+    BENCHMARK("mpeg2, slicing-by-16, 64 MB")
+    {
+        return crc32_mpeg2::update_slicing<16>(0, data.data(), data.size());
+    };
+#ifdef PRIMITIVES_X86
+    if (cpu_features::get().pclmul)
+    {
+        BENCHMARK("ieee, pclmul, 64 MB")
+        {
+            return crc32_ieee::update_pclmul(0, data.data(), data.size());
+        };
+        BENCHMARK("mpeg2, pclmul, 64 MB")
+        {
+            return crc32_mpeg2::update_pclmul(0, data.data(), data.size());
+        };
+        BENCHMARK("crc32c, pclmul, 64 MB")
+        {
+            return crc32c::update_pclmul(0, data.data(), data.size());
+        };
+    }
+    if (cpu_features::get().sse42)
+    {
+        BENCHMARK("crc32c, sse4.2, 64 MB")
+        {
+            return crc32c::update_sse42(0, data.data(), data.size());
+        };
+    }
+#endif
+}
+
+TEST_CASE("Checking base64", "[base64]")
+{
+    // rfc 4648
+    std::vector<String> in{ "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    std::vector<String> b64{ "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+    std::vector<String> b32{ "", "MY======", "MZXQ====", "MZXW6===", "MZXW6YQ=", "MZXW6YTB", "MZXW6YTBOI======" };
+    std::vector<String> b16{ "", "66", "666F", "666F6F", "666F6F62", "666F6F6261", "666F6F626172" };
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        CHECK(base64::encode(in[i]) == b64[i]);
+        CHECK(base64::decode(b64[i]) == in[i]);
+        CHECK(base32::encode(in[i]) == b32[i]);
+        CHECK(base32::decode(b32[i]) == in[i]);
+        CHECK(base16::encode(in[i]) == b16[i]);
+        CHECK(base16::decode(b16[i]) == in[i]);
+    }
+    CHECK(base64url<>::encode("\xfb\xff"s) == "-_8");
+    CHECK(base64url<>::decode("-_8"s) == "\xfb\xff");
+    CHECK_THROWS(base64::decode("Zm9"s));
+
+    // fast paths give the same results as the generic one
+    auto check = [](auto c)
+    {
+        using C = decltype(c);
+        for (size_t n = 0; n < 300; n++)
+        {
+            String s(n, 0);
+            for (size_t i = 0; i < n; i++)
+                s[i] = (char)(i * 131 + n);
+            auto e = C::encode(s);
+            CHECK(e == C::encode_generic(s));
+            CHECK(C::encode(std::list<char>(s.begin(), s.end())) == e);
+            CHECK(C::decode(e) == s);
+            CHECK(C::decode_generic(e) == s);
+            if (!e.empty())
+            {
+                // bad chars take the generic path
+                e[e.size() / 2] = '!';
+                CHECK(C::decode(e) == C::decode_generic(e));
+            }
+        }
+    };
+    check(base64{});
+    check(base64url<>{});
+    check(base64url<true>{});
+    check(base32{});
+    check(base32extended_hex{});
+    check(base16{});
+}
+
+TEST_CASE("Checking base64: streaming", "[base64]")
+{
+    String data(10000, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 131 + i / 7);
+
+    auto check = [&data](auto c)
+    {
+        using C = decltype(c);
+        auto e = C::encode(data);
+        // any split gives the same result
+        for (size_t step : {1, 2, 3, 5, 7, 64, 1000})
+        {
+            typename C::encoder enc;
+            typename C::decoder dec;
+            String e2, d2, buf(enc.max_output(step) + dec.max_output(step), 0);
+            for (size_t i = 0; i < data.size(); i += step)
+                e2.append(buf.data(), enc.update(data.data() + i, std::min(step, data.size() - i), buf.data()));
+            e2.append(buf.data(), enc.finish(buf.data()));
+            CHECK(e2 == e);
+            for (size_t i = 0; i < e.size(); i += step)
+                d2.append(buf.data(), dec.update(e.data() + i, std::min(step, e.size() - i), buf.data()));
+            d2.append(buf.data(), dec.finish(buf.data()));
+            CHECK(d2 == data);
+        }
+    };
+    check(base64{});
+    check(base64url<>{});
+    check(base32{});
+    check(base16{});
+
+    // mime lines
+    String mime;
+    base64::encode_to(data, [&mime](const char *p, size_t n) { mime.append(p, n); }, 76, 100);
+    auto e = base64::encode(data);
+    CHECK(mime.size() == e.size() + (e.size() - 1) / 76 * 2);
+    CHECK(mime.substr(0, 76) == e.substr(0, 76));
+    CHECK(mime.substr(76, 2) == "\r\n");
+    String d;
+    base64::decode_to(mime, [&d](const char *p, size_t n) { d.append(p, n); }, 33);
+    CHECK(d == data);
+    CHECK_THROWS(base64::encoder{70});
+    CHECK_THROWS(base64::decode_to("Zm9v!A=="s, [](const char *, size_t) {}));
+    CHECK_THROWS(base64::decode_to("Zg==Zg=="s, [](const char *, size_t) {}));
+
+    // file -> file through bounded buffers, mmap input
+    auto dir = fs::temp_directory_path() / "primitives_base64_test";
+    fs::create_directories(dir);
+    write_file(dir / "in", data);
+    {
+        primitives::templates2::mmap_file<char> in{dir / "in"};
+        ScopedFile out(dir / "out", "wb");
+        base64::encode_to(in, [&out](const char *p, size_t n) { fwrite(p, 1, n, out); }, 76, 4096);
+    }
+    CHECK(read_file(dir / "out") == mime);
+    {
+        ScopedFile in(dir / "out"), out(dir / "in2", "wb");
+        base64::decode_stream([&in](char *p, size_t n) { return in.read(p, n); }, [&out](const char *p, size_t n) { fwrite(p, 1, n, out); }, 100);
+    }
+    CHECK(read_file(dir / "in2") == data);
+
+    // pull mode, curl read callback
+    {
+        ScopedFile in(dir / "in");
+        base64::encode_reader r{[&in](char *p, size_t n) { return in.read(p, n); }, 76, 1000};
+        String s, buf(7, 0);
+        while (auto n = decltype(r)::read_callback(buf.data(), 1, buf.size(), &r))
+            s.append(buf.data(), n);
+        CHECK(s == mime);
+    }
+
+    // email attachments are streamed by curl sized pieces
+    {
+        primitives::Email m;
+        m.to = {"to", "to@example.com"};
+        m.from = {"from", "from@example.com"};
+        m.title = "test";
+        m.body = "hello";
+        m.attachments.push_back(dir / "in");
+        auto u = m.payload();
+        String s, buf(1000, 0);
+        while (auto n = primitives::detail::payload_source(buf.data(), 1, buf.size(), &u))
+            s.append(buf.data(), n);
+        CHECK(s.find("Content-Transfer-Encoding: base64\r\n") != s.npos);
+        CHECK(s.find(mime) != s.npos);
+    }
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Benchmarking base64", "[.][base64][benchmark]")
+{
+    String data(16 * 1024 * 1024, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 131);
+
+    auto bench = [&data](const String &name, auto c)
+    {
+        using C = decltype(c);
+        auto e = C::encode(data);
+        BENCHMARK(name + " encode, 16 MB")
+        {
+            return C::encode(data);
+        };
+        BENCHMARK(name + " decode, 16 MB")
+        {
+            return C::decode(e);
+        };
+    };
+    BENCHMARK("base64 generic encode, 16 MB")
+    {
+        return base64::encode_generic(data);
+    };
+    bench("base64", base64{});
+    bench("base64url", base64url<>{});
+    bench("base32", base32{});
+    bench("base16", base16{});
+}
+
+TEST_CASE("Checking mmap", "[mmap]")
+{
+    using primitives::templates2::mmap_file;
+    using primitives::templates2::mmap_options;
+
+    auto dir = fs::temp_directory_path() / "primitives_mmap_test";
+    fs::remove_all(dir);
+
+    auto fill = [](auto &m, uint64_t n)
+    {
+        auto s = m.get_stream();
+        for (uint64_t i = 0; i < n; i++)
+            s << i;
+        return s.offset;
+    };
+    auto check = [](const path &fn, uint64_t n)
+    {
+        mmap_file<uint8_t> m{fn};
+        auto s = m.get_stream();
+        uint64_t v;
+        for (uint64_t i = 0; i < n; i++)
+        {
+            s >> v;
+            if (v != i)
+                return false;
+        }
+        return true;
+    };
+
+    // remap on growth
+    {
+        mmap_file<uint8_t> m{dir / "a", mmap_file<uint8_t>::rw{}};
+        CHECK(fill(m, 100000) == 800000);
+        CHECK(m.sz >= 800000);
+    }
+    CHECK(check(dir / "a", 100000));
+
+    // growth in place, pointers stay valid
+    {
+        mmap_file<uint8_t> m{dir / "b", mmap_file<uint8_t>::growable{}};
+        auto s = m.get_stream();
+        s << (uint64_t)0;
+        auto p = m.p;
+        for (uint64_t i = 1; i < 100000; i++)
+            s << i;
+        CHECK(m.p == p);
+    }
+    CHECK(check(dir / "b", 100000));
+
+    // reserve is exceeded, mapping moves once
+    {
+        mmap_file<uint8_t>::growable g;
+        g.reserve = 1 << 16;
+        mmap_file<uint8_t> m{dir / "c", g};
+        fill(m, 100000);
+    }
+    CHECK(check(dir / "c", 100000));
+
+    // existing file, reopened as growable
+    {
+        mmap_file<uint8_t> m{dir / "c", mmap_file<uint8_t>::growable{}};
+        auto p = m.p;
+        auto s = m.get_stream();
+        s.offset = 800000;
+        for (uint64_t i = 100000; i < 200000; i++)
+            s << i;
+        CHECK(m.p == p);
+    }
+    CHECK(check(dir / "c", 200000));
+
+    // shrinking unmaps the tail
+    {
+        mmap_file<uint64_t> m{dir / "shrink", mmap_file<uint64_t>::rw{}};
+        m.resize(1 << 17);
+        m[512] = 1;
+        m[1000] = 2;
+        m.resize(1024);
+        CHECK(m.sz == 1024);
+        m[1023] = 3;
+        m.resize(0);
+        m.resize(1 << 17);
+        m[1000] = 4;
+        m.resize(1024);
+    }
+    {
+        mmap_file<uint64_t> m{dir / "shrink"};
+        CHECK(m.sz == 1024);
+        CHECK(m[512] == 0);
+        CHECK(m[1000] == 4);
+        CHECK(m[1023] == 0);
+    }
+#ifdef __linux__
+    {
+        std::ifstream maps{"/proc/self/maps"};
+        std::string line;
+        int n = 0;
+        while (std::getline(maps, line))
+            n += line.find("shrink") != line.npos;
+        CHECK(n == 0);
+    }
+#endif
+
+    // hints do not change contents
+    for (auto o : {mmap_options{mmap_options::sequential}, mmap_options{mmap_options::random}, mmap_options{.will_need = true},
+                   mmap_options{.populate = true}, mmap_options{.huge_pages = true}})
+    {
+        mmap_file<uint64_t> m{dir / "c", o};
+        CHECK(m.sz >= 200000);
+        CHECK(m[199999] == 199999);
+        m.prefetch(1000, 100000);
+        m.drop(0, m.sz);
+        CHECK(m[123456] == 123456);
+    }
+    // dropped dirty pages stay in the file
+    {
+        mmap_file<uint64_t> m{dir / "c", mmap_file<uint64_t>::rw{}, {.populate = true}};
+        m[1000] = 42;
+        m.drop(0, m.sz);
+        CHECK(m[1000] == 42);
+        m.drop(m.sz, 100);
+    }
+    CHECK(mmap_file<uint64_t>{dir / "c"}[1000] == 42);
+
+    // copy-on-write changes are not written
+    {
+        mmap_file<uint64_t> m{dir / "c", mmap_file<uint64_t>::cow{}};
+        m[1000] = 43;
+        CHECK(m[1000] == 43);
+        CHECK_THROWS(m.alloc(1));
+    }
+    CHECK(mmap_file<uint64_t>{dir / "c"}[1000] == 42);
+
+    // unaligned part of a file, sizes are in elements
+    {
+        mmap_file<uint64_t> m{dir / "c", mmap_file<uint64_t>::rw{}, {.offset = 8 * 1000, .size = 8 * 100 + 5}};
+        CHECK(m.sz == 100);
+        CHECK(m.size_bytes() == 800);
+        CHECK(m[0] == 42);
+        CHECK(m[99] == 1099);
+        auto s = m.span(10, 1000);
+        CHECK(s.size() == 90);
+        CHECK(s[0] == 1010);
+        m[1] = 7;
+        m.flush();
+        m.flush(1, 1, true);
+        m.prefetch(0, 100);
+        m.drop(0, 100);
+        CHECK(m[1] == 7);
+        CHECK_THROWS(m.alloc(1));
+    }
+    CHECK(mmap_file<uint64_t>{dir / "c"}[1001] == 7);
+    {
+        mmap_file<uint64_t> m{dir / "c", mmap_file<uint64_t>::ro{}, {.offset = 8 * 1000 + 4096 * 3 + 1}};
+        CHECK(m.sz == (mmap_file<uint64_t>{dir / "c"}.size_bytes() - 8 * 1000 - 4096 * 3 - 1) / 8);
+        CHECK(m.span().size() == m.sz);
+    }
+
+    // stream offsets are in bytes for any element type
+    {
+        mmap_file<uint32_t> m{dir / "d", mmap_file<uint32_t>::growable{}};
+        auto s = m.get_stream();
+        for (uint64_t i = 0; i < 1000; i++)
+            s << (uint8_t)1 << i;
+        CHECK(s.offset == 9000);
+        CHECK(m.size_bytes() >= 9000);
+    }
+    {
+        mmap_file<uint32_t> m{dir / "d"};
+        auto s = m.get_stream();
+        uint8_t b;
+        uint64_t v;
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            s >> b >> v;
+            CHECK(v == i);
+        }
+    }
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Checking mmap: records", "[mmap]")
+{
+    using primitives::templates2::record_file;
+
+    struct point
+    {
+        uint32_t x, y;
+        double w;
+    };
+
+    auto dir = fs::temp_directory_path() / "primitives_records_test";
+    fs::remove_all(dir);
+    auto fn = dir / "r";
+    {
+        record_file r{fn};
+        CHECK(r.empty());
+        CHECK(r.append("hello"s) == 0);
+        CHECK(r.append(point{1, 2, 3.5}) == 1);
+        CHECK(r.append(String{}) == 2);
+        std::vector<point> pts;
+        for (uint32_t i = 0; i < 100; i++)
+            pts.push_back({i, i * 2, i / 2.});
+        CHECK(r.append(pts) == 3);
+        std::vector<uint64_t> many(100000);
+        std::iota(many.begin(), many.end(), 0);
+        CHECK(r.append_many(many) == 4);
+        CHECK(r.size() == 100004);
+    }
+    auto check = [&fn]()
+    {
+        record_file r{fn};
+        REQUIRE(r.size() == 100004);
+        CHECK(String(r[0].begin(), r[0].end()) == "hello");
+        CHECK(r.get<point>(1).y == 2);
+        CHECK(r.get<point>(1).w == 3.5);
+        CHECK(r[2].empty());
+        auto v = r.view<point>(3);
+        CHECK(v.size() == 100);
+        CHECK(v[99].y == 198);
+        CHECK((uintptr_t)v.data() % alignof(point) == 0);
+        bool ok = true;
+        for (uint64_t i = 0; i < 100000; i++)
+            ok &= r.get<uint64_t>(i + 4) == i;
+        CHECK(ok);
+        CHECK_THROWS(r.at(100004));
+    };
+    check();
+    // index is rebuilt from data
+    fs::remove(path{fn} += ".index");
+    check();
+    // index is behind after a crash
+    {
+        primitives::templates2::mmap_file<uint64_t> idx{path{fn} += ".index", primitives::templates2::mmap_file<uint64_t>::rw{}};
+        idx[0] = 10;
+    }
+    check();
+    // corrupt index, data is rescanned
+    auto end = record_file{fn}.size_bytes();
+    for (uint64_t last : {end, end + 8, uint64_t(-8)})
+    {
+        {
+            primitives::templates2::mmap_file<uint64_t> idx{path{fn} += ".index", primitives::templates2::mmap_file<uint64_t>::rw{}};
+            idx[100004] = last;
+        }
+        check();
+    }
+    {
+        primitives::templates2::mmap_file<uint64_t> idx{path{fn} += ".index", primitives::templates2::mmap_file<uint64_t>::rw{}};
+        idx[0] = -1;
+    }
+    check();
+    {
+        record_file r{fn};
+        r.append("tail"s);
+    }
+    CHECK(record_file{fn}.size() == 100005);
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Checking mmap: concurrent readers", "[mmap]")
+{
+    using primitives::templates2::record_file;
+
+    auto dir = fs::temp_directory_path() / "primitives_records_concurrent_test";
+    fs::remove_all(dir);
+    const uint64_t n = 200'000;
+    {
+        // small reserve, the data mapping moves several times under readers
+        record_file r{dir / "r", 64 * 1024};
+        std::atomic_bool done{};
+        std::atomic_int errors{};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; t++)
+        {
+            readers.emplace_back([&]
+            {
+                // tail following
+                uint64_t seen = 0;
+                while (seen < n)
+                {
+                    // everything is appended when done is set, so the snapshot after it must be complete
+                    bool d = done;
+                    auto s = r.read();
+                    for (; seen < s.size(); seen++)
+                    {
+                        auto v = s.view<uint64_t>(seen);
+                        if (v.size() != seen % 4 + 1 || v[0] != seen)
+                            errors++;
+                    }
+                    if (d && seen < n)
+                        errors++, seen = n;
+                }
+            });
+        }
+        std::vector<uint64_t> rec;
+        for (uint64_t i = 0; i < n;)
+        {
+            // single appends and batches
+            if (i % 1000 < 900)
+            {
+                rec.assign(i % 4 + 1, i);
+                r.append(rec);
+                i++;
+                continue;
+            }
+            std::vector<std::vector<uint64_t>> batch;
+            for (auto e = i + 100; i < e; i++)
+                batch.emplace_back(i % 4 + 1, i);
+            r.append_many(batch);
+        }
+        done = true;
+        for (auto &t : readers)
+            t.join();
+        CHECK(errors == 0);
+        CHECK(r.size() == n);
+        CHECK(r.reclaim() == 0);
+    }
+    CHECK(record_file{dir / "r"}.size() == n);
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Benchmarking mmap: append", "[.][mmap][benchmark]")
+{
+    using primitives::templates2::mmap_file;
+
+    auto dir = fs::temp_directory_path() / "primitives_mmap_bench";
+    fs::create_directories(dir);
+    auto bench = [&dir](const String &name, auto mode)
+    {
+        BENCHMARK(name + ", 10M u64")
+        {
+            fs::remove(dir / "f");
+            mmap_file<uint8_t> m{dir / "f", mode};
+            auto s = m.get_stream();
+            for (uint64_t i = 0; i < 10'000'000; i++)
+                s << i;
+            return s.offset;
+        };
+    };
+    bench("remap", mmap_file<uint8_t>::rw{});
+    bench("growable", mmap_file<uint8_t>::growable{});
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Benchmarking mmap: records", "[.][mmap][benchmark]")
+{
+    using primitives::templates2::record_file;
+
+    auto dir = fs::temp_directory_path() / "primitives_records_bench";
+    fs::remove_all(dir);
+    std::vector<uint64_t> v(1'000'000);
+    std::iota(v.begin(), v.end(), 0);
+    BENCHMARK("append one by one, 1M")
+    {
+        fs::remove_all(dir);
+        record_file r{dir / "a"};
+        for (auto &i : v)
+            r.append(i);
+        return r.size();
+    };
+    BENCHMARK("append batch, 1M")
+    {
+        fs::remove_all(dir);
+        record_file r{dir / "b"};
+        return r.append_many(v);
+    };
+    record_file r{dir / "b"};
+    BENCHMARK("random access, 1M")
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0, j = 0; i < r.size(); i++, j = (j + 7919) % r.size())
+            sum += r.get<uint64_t>(j);
+        return sum;
+    };
+    BENCHMARK("open with index rebuild, 1M")
+    {
+        fs::remove(dir / "b.index");
+        return record_file{dir / "b"}.size();
+    };
+    fs::remove_all(dir);
+}
+
+TEST_CASE("Benchmarking mmap: scan", "[.][mmap][benchmark]")
+{
+    using primitives::templates2::mmap_file;
+    using primitives::templates2::mmap_options;
+
+    auto dir = fs::temp_directory_path() / "primitives_mmap_bench";
+    fs::create_directories(dir);
+    auto fn = dir / "f";
+    {
+        mmap_file<uint64_t> m{fn, mmap_file<uint64_t>::rw{}};
+        m.alloc_raw(64 * 1024 * 1024);
+        for (uint64_t i = 0; i < m.sz; i++)
+            m[i] = i;
+    }
+    auto scan = [&fn](const mmap_options &o)
+    {
+        mmap_file<uint64_t> m{fn, o};
+        return std::accumulate(m.begin(), m.end(), (uint64_t)0);
+    };
+    auto bench = [&](const String &name, const mmap_options &o)
+    {
+        // page cache is dropped before every run
+        BENCHMARK_ADVANCED(name + ", cold, 512 MB")(Catch::Benchmark::Chronometer meter)
+        {
+            mmap_file<uint64_t>{fn}.drop(0, -1);
+            meter.measure([&] { return scan(o); });
+        };
+        BENCHMARK(name + ", warm, 512 MB")
+        {
+            return scan(o);
+        };
+    };
+    bench("default", {});
+    bench("sequential", {mmap_options::sequential});
+    bench("random", {mmap_options::random});
+    bench("will need", {.will_need = true});
+    bench("populate", {.populate = true});
+    bench("huge pages", {.huge_pages = true});
+    bench("sequential + populate", {mmap_options::sequential, false, true});
+    fs::remove_all(dir);
 }
 
 TEST_CASE("Checking exceptions", "[templates.exceptions]")
@@ -3,9 +3,17 @@
 
 #pragma once
 
+#include "cpu.h"
 #include "string.h"
 
+#include <array>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <format>
 #include <numeric>
+#include <ranges>
+#include <stdexcept>
 #include <string>
 
 using namespace std::literals;
@@ -35,14 +43,44 @@ struct base_raw {
     static inline constexpr auto can_have_tail = lcm == encoded_block_size;
     static inline constexpr auto max_tail = encoded_block_size - divceil(byte_bits, n_bits);
 
-    static consteval auto make_decoder() {
-        std::array<uint8_t, 128> alph{};
+    static consteval auto make_decoder(uint8_t invalid) {
+        std::array<uint8_t, 256> alph{};
+        alph.fill(invalid);
         for (int i = 0; auto &&c : Alphabet) {
-            alph[c] = i++;
+            alph[(u8)c] = i++;
         }
         return alph;
     }
-    static inline constexpr auto DecodeAlphabet = make_decoder();
+    static inline constexpr auto DecodeAlphabet = make_decoder(0);
+
+    // full blocks go through tables (and simd for base64 alphabets), generic bit loops handle the tail
+    static inline constexpr auto has_fast_path = Nchars == (1 << n_bits) && n_bits <= 6;
+    static inline constexpr auto EncodeTable = [] {
+        std::array<char, Nchars> alph{};
+        for (int i = 0; auto &&c : Alphabet) {
+            alph[i++] = c;
+        }
+        return alph;
+    }();
+    static inline constexpr auto DecodeTable = make_decoder(0xff);
+    // only the last two chars differ from the standard ones
+    static inline constexpr auto has_simd = [] {
+        if constexpr (Nchars != 64) {
+            return false;
+        } else {
+            for (int i = 0; i < 26; ++i) {
+                if (Alphabet[i] != 'A' + i || Alphabet[26 + i] != 'a' + i) {
+                    return false;
+                }
+            }
+            for (int i = 0; i < 10; ++i) {
+                if (Alphabet[52 + i] != '0' + i) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }();
 
     static auto name() {return std::format("base{}", Nchars);}
     static auto encoded_size(auto decoded_size) {
@@ -88,14 +126,15 @@ struct base_raw {
                     *p2++ = padding;
                 }
             } else {
-                auto outsz = output_size;
+                int chars = 0;
                 for (int i = 0, start = 0; i < data_size; ++i, start += n_bits) {
-                    if (data[i] == padding) {
-                        --outsz;
+                    if (data[i] != padding) {
+                        ++chars;
                     }
                     set_bits(DecodeAlphabet[data[i]], start, p);
                 }
-                p += outsz;
+                // padding chars carry no data bits
+                p += chars * n_bits / byte_bits;
             }
         }
 
@@ -119,7 +158,7 @@ struct base_raw {
         }
         static void set_bits(u8 value, auto &&start, auto &p) {
             auto b1 = start / byte_bits;
-            auto b2 = (start + n_bits) / byte_bits;
+            auto b2 = (start + n_bits - 1) / byte_bits;
             if (b1 == b2) {
                 auto bits1 = byte_bits - start % byte_bits - n_bits;
                 p[b1] |= value << bits1;
@@ -132,7 +171,18 @@ struct base_raw {
         }
     };
 
+    template <typename T>
+    static inline constexpr auto is_byte_range =
+        std::ranges::contiguous_range<T> && std::ranges::sized_range<T> && sizeof(std::ranges::range_value_t<T>) == 1;
+
     static auto encode(auto &&data) {
+        if constexpr (has_fast_path && is_byte_range<decltype(data)>) {
+            return encode_fast((const u8 *)std::ranges::data(data), std::ranges::size(data));
+        } else {
+            return encode_generic(data);
+        }
+    }
+    static auto encode_generic(auto &&data) {
         auto sz = data.size();
         std::string out;
         if (sz == 0) {
@@ -152,6 +202,14 @@ struct base_raw {
     }
     template <bool IgnoreNonAlphabetChars>
     static auto decode(auto &&data) {
+        if constexpr (has_fast_path && !IgnoreNonAlphabetChars && is_byte_range<decltype(data)>) {
+            return decode_fast((const char *)std::ranges::data(data), std::ranges::size(data));
+        } else {
+            return decode_generic<IgnoreNonAlphabetChars>(data);
+        }
+    }
+    template <bool IgnoreNonAlphabetChars = false>
+    static auto decode_generic(auto &&data) {
         auto sz = data.size();
         if ((sz % encoded_block_size) && Pad && !IgnoreNonAlphabetChars) {
             throw std::runtime_error{std::format("bad {}: incorrect length", name())};
@@ -181,6 +239,484 @@ struct base_raw {
     static auto decode(auto &&data) {
         return decode<false>(data);
     }
+
+    // whole blocks only, returns the end of output
+    static char *encode_blocks(const u8 *in, size_t sz, char *p) {
+        size_t i{};
+#ifdef PRIMITIVES_X86
+        if constexpr (has_simd) {
+            auto &cpu = primitives::templates2::cpu_features::get();
+            if (cpu.avx2) {
+                i = encode_avx2(in, sz, p);
+            } else if (cpu.ssse3) {
+                i = encode_ssse3(in, sz, p);
+            }
+        }
+#endif
+        for (; i + decoded_block_size <= sz; i += decoded_block_size, p += encoded_block_size) {
+            uint64_t v{};
+            for (int k = 0; k < decoded_block_size; ++k) {
+                v = v << byte_bits | in[i + k];
+            }
+            for (int k = 0; k < encoded_block_size; ++k) {
+                p[k] = EncodeTable[(v >> (n_bits * (encoded_block_size - 1 - k))) & (Nchars - 1)];
+            }
+        }
+        return p;
+    }
+    // whole blocks only, stops before the first block with a char outside of the alphabet
+    // returns number of decoded chars
+    static size_t decode_blocks(const char *in, size_t n, u8 *&p) {
+        size_t i{};
+#ifdef PRIMITIVES_X86
+        if constexpr (has_simd) {
+            auto end = p + n / encoded_block_size * decoded_block_size;
+            auto &cpu = primitives::templates2::cpu_features::get();
+            if (cpu.avx2) {
+                i = decode_avx2(in, n, p, end);
+            } else if (cpu.ssse3) {
+                i = decode_ssse3(in, n, p, end);
+            }
+        }
+#endif
+        for (; i + encoded_block_size <= n; i += encoded_block_size, p += decoded_block_size) {
+            uint64_t v{};
+            u8 bad{};
+            for (int k = 0; k < encoded_block_size; ++k) {
+                auto d = DecodeTable[(u8)in[i + k]];
+                bad |= d;
+                v = v << n_bits | d;
+            }
+            if (bad & 0x80) {
+                break;
+            }
+            for (int k = 0; k < decoded_block_size; ++k) {
+                p[k] = v >> (byte_bits * (decoded_block_size - 1 - k));
+            }
+        }
+        return i;
+    }
+
+    static std::string encode_fast(const u8 *in, size_t sz) {
+        std::string out;
+        if (sz == 0) {
+            return out;
+        }
+        // exact size, no zero filling; without padding the string is only shrunk
+        auto outsz = encoded_size(sz);
+        out.resize_and_overwrite(outsz, [&](char *p, size_t) {
+            auto start = p;
+            auto full = sz / decoded_block_size * decoded_block_size;
+            p = encode_blocks(in, full, p);
+            b2<true> conv;
+            for (auto i = full; i < sz; ++i) {
+                conv.add(in[i], p);
+            }
+            conv.finish(p);
+            return Pad ? outsz : (size_t)(p - start);
+        });
+        return out;
+    }
+    static std::string decode_fast(const char *in, size_t sz) {
+        if ((sz % encoded_block_size) && Pad) {
+            throw std::runtime_error{std::format("bad {}: incorrect length", name())};
+        }
+        std::string out;
+        if (sz == 0) {
+            return out;
+        }
+        auto n = sz;
+        while (n && in[n - 1] == padding) {
+            --n;
+        }
+        auto outsz = n * n_bits / byte_bits;
+        bool ok{};
+        out.resize_and_overwrite(outsz, [&](char *out, size_t) -> size_t {
+            auto p = (u8 *)out;
+            auto full = n / encoded_block_size * encoded_block_size;
+            auto i = decode_blocks(in, full, p);
+            if (i != full || sz - i > encoded_block_size) {
+                return 0;
+            }
+            u8 tail[decoded_block_size]{};
+            auto tp = tail;
+            b2<false> conv;
+            for (; i < sz; ++i) {
+                conv.add(in[i], tp);
+            }
+            conv.finish(tp);
+            if (tp - tail != (u8 *)out + outsz - p) {
+                return 0;
+            }
+            std::memcpy(p, tail, tp - tail);
+            ok = true;
+            return outsz;
+        });
+        // bad chars or stray padding, keep the old behaviour
+        if (!ok) {
+            return decode_generic(std::string_view{in, sz});
+        }
+        return out;
+    }
+
+    /// Streaming encoder, a partial block is kept between calls.
+    /// line_length > 0 breaks output into "\r\n" separated lines (mime uses 76).
+    struct encoder {
+        size_t line_length{};
+
+        encoder(size_t line_length = 0) : line_length{line_length} {
+            if (line_length % encoded_block_size) {
+                throw std::runtime_error{std::format("bad {}: line length must be a multiple of {}", name(), encoded_block_size)};
+            }
+        }
+
+        /// upper bound of output of update(n) + finish()
+        size_t max_output(size_t n) const {
+            auto e = encoded_size(n + decoded_block_size);
+            return line_length ? e + (e / line_length + 1) * 2 : e;
+        }
+        /// returns number of chars written to out
+        size_t update(const void *data, size_t n, char *out) {
+            auto in = (const u8 *)data;
+            auto p = out;
+            if (npartial) {
+                for (; npartial < decoded_block_size && n; --n) {
+                    partial[npartial++] = *in++;
+                }
+                if (npartial < decoded_block_size) {
+                    return 0;
+                }
+                p = put(partial, decoded_block_size, p);
+                npartial = 0;
+            }
+            auto full = n / decoded_block_size * decoded_block_size;
+            p = put(in, full, p);
+            std::memcpy(partial, in + full, n - full);
+            npartial = n - full;
+            return p - out;
+        }
+        /// writes the last block and resets the encoder
+        size_t finish(char *out) {
+            auto p = out;
+            if (npartial) {
+                char tmp[encoded_block_size];
+                auto tp = tmp;
+                b2<true> conv;
+                for (size_t i = 0; i < npartial; ++i) {
+                    conv.add(partial[i], tp);
+                }
+                conv.finish(tp);
+                auto n = Pad ? encoded_block_size : tp - tmp;
+                line_break(p);
+                std::memcpy(p, tmp, n);
+                p += n;
+            }
+            npartial = 0;
+            column = 0;
+            return p - out;
+        }
+
+    private:
+        u8 partial[decoded_block_size]{};
+        size_t npartial{};
+        size_t column{};
+
+        void line_break(char *&p) {
+            if (line_length && column == line_length) {
+                *p++ = '\r';
+                *p++ = '\n';
+                column = 0;
+            }
+        }
+        char *put(const u8 *in, size_t n, char *p) {
+            if (!line_length) {
+                return encode_blocks(in, n, p);
+            }
+            while (n) {
+                line_break(p);
+                auto k = std::min(n, (line_length - column) / encoded_block_size * decoded_block_size);
+                p = encode_blocks(in, k, p);
+                column += k / decoded_block_size * encoded_block_size;
+                in += k;
+                n -= k;
+            }
+            return p;
+        }
+    };
+
+    /// Streaming decoder, a partial block is kept between calls. Whitespace (mime line breaks) is skipped.
+    struct decoder {
+        /// upper bound of output of update(n) + finish()
+        static size_t max_output(size_t n) {
+            return decoded_size(n + encoded_block_size);
+        }
+        /// returns number of bytes written to out
+        size_t update(const char *data, size_t n, char *out) {
+            auto p = (u8 *)out;
+            auto end = data + n;
+            while (data != end) {
+                // whole blocks are decoded in place until a line break, padding or a bad char
+                if (!npartial && !padded) {
+                    data += decode_blocks(data, (end - data) / encoded_block_size * encoded_block_size, p);
+                    if (data == end) {
+                        break;
+                    }
+                }
+                auto c = *data++;
+                if (is_space(c)) {
+                    continue;
+                }
+                if (c != padding && padded) {
+                    throw std::runtime_error{std::format("bad {}: data after padding", name())};
+                }
+                padded |= c == padding;
+                partial[npartial++] = c;
+                if (npartial == encoded_block_size) {
+                    if (padded) {
+                        flush(p);
+                    } else if (decode_blocks(partial, encoded_block_size, p) != encoded_block_size) {
+                        bad_char();
+                    }
+                    npartial = 0;
+                }
+            }
+            return p - (u8 *)out;
+        }
+        /// writes the last block and resets the decoder
+        size_t finish(char *out) {
+            auto p = (u8 *)out;
+            flush(p);
+            padded = false;
+            return p - (u8 *)out;
+        }
+
+    private:
+        char partial[encoded_block_size]{};
+        size_t npartial{};
+        bool padded{};
+
+        static bool is_space(char c) {
+            return c == '\r' || c == '\n' || c == ' ' || c == '\t';
+        }
+        void bad_char() {
+            throw std::runtime_error{std::format("bad {}: invalid char", name())};
+        }
+        void flush(u8 *&p) {
+            if (!npartial) {
+                return;
+            }
+            u8 tmp[decoded_block_size]{};
+            auto tp = tmp;
+            b2<false> conv;
+            for (size_t i = 0; i < npartial; ++i) {
+                if (partial[i] != padding && DecodeTable[(u8)partial[i]] == 0xff) {
+                    bad_char();
+                }
+                conv.add(partial[i], tp);
+            }
+            conv.finish(tp);
+            std::memcpy(p, tmp, tp - tmp);
+            p += tp - tmp;
+            npartial = 0;
+        }
+    };
+
+    /// Pull encoder: read() fills the caller buffer from source(char *, size_t) -> size_t (0 on eof).
+    /// read_callback() has the signature of curl CURLOPT_READFUNCTION with this object as data.
+    template <typename Reader>
+    struct encode_reader {
+        encode_reader(Reader source, size_t line_length = 0, size_t buffer_size = 1 << 16)
+            : source{std::move(source)}, e{line_length}, in(buffer_size, 0), buf(e.max_output(buffer_size), 0) {
+        }
+
+        size_t read(char *out, size_t n) {
+            size_t total{};
+            while (total < n) {
+                if (pos == len) {
+                    if (eof) {
+                        break;
+                    }
+                    refill();
+                    continue;
+                }
+                auto k = std::min(n - total, len - pos);
+                std::memcpy(out + total, buf.data() + pos, k);
+                pos += k;
+                total += k;
+            }
+            return total;
+        }
+        static size_t read_callback(char *ptr, size_t size, size_t nmemb, void *self) {
+            return ((encode_reader *)self)->read(ptr, size * nmemb);
+        }
+
+    private:
+        Reader source;
+        encoder e;
+        std::string in;
+        std::string buf;
+        size_t pos{};
+        size_t len{};
+        bool eof{};
+
+        void refill() {
+            auto n = source(in.data(), in.size());
+            if (n == 0) {
+                len = e.finish(buf.data());
+                eof = true;
+            } else {
+                len = e.update(in.data(), n, buf.data());
+            }
+            pos = 0;
+        }
+    };
+
+    /// Encodes from read(char *, size_t) -> size_t (0 on eof) to write(const char *, size_t) through a bounded buffer.
+    static void encode_stream(auto &&read, auto &&write, size_t line_length = 0, size_t buffer_size = 1 << 16) {
+        encoder e{line_length};
+        std::string in(buffer_size, 0), out(e.max_output(buffer_size), 0);
+        while (auto n = read(in.data(), in.size())) {
+            if (auto k = e.update(in.data(), n, out.data())) {
+                write(out.data(), k);
+            }
+        }
+        if (auto k = e.finish(out.data())) {
+            write(out.data(), k);
+        }
+    }
+    static void decode_stream(auto &&read, auto &&write, size_t buffer_size = 1 << 16) {
+        decoder d;
+        std::string in(buffer_size, 0), out(d.max_output(buffer_size), 0);
+        while (auto n = read(in.data(), in.size())) {
+            if (auto k = d.update(in.data(), n, out.data())) {
+                write(out.data(), k);
+            }
+        }
+        if (auto k = d.finish(out.data())) {
+            write(out.data(), k);
+        }
+    }
+    /// Encodes contiguous data (strings, spans over mmap_file) to write(const char *, size_t) through a bounded buffer.
+    static void encode_to(auto &&data, auto &&write, size_t line_length = 0, size_t buffer_size = 1 << 16) {
+        auto p = (const char *)std::ranges::data(data);
+        auto n = std::ranges::size(data) * sizeof(*std::ranges::data(data));
+        encode_stream([&](char *out, size_t sz) {
+            sz = std::min(sz, n);
+            std::memcpy(out, p, sz);
+            p += sz;
+            n -= sz;
+            return sz;
+        }, write, line_length, buffer_size);
+    }
+    static void decode_to(auto &&data, auto &&write, size_t buffer_size = 1 << 16) {
+        decoder d;
+        std::string out(d.max_output(buffer_size), 0);
+        auto p = (const char *)std::ranges::data(data);
+        auto n = std::ranges::size(data) * sizeof(*std::ranges::data(data));
+        for (size_t i = 0; i < n; i += buffer_size) {
+            if (auto k = d.update(p + i, std::min(buffer_size, n - i), out.data())) {
+                write(out.data(), k);
+            }
+        }
+        if (auto k = d.finish(out.data())) {
+            write(out.data(), k);
+        }
+    }
+
+#ifdef PRIMITIVES_X86
+    // 6 bit values to chars, see http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+    PRIMITIVES_TARGET("ssse3")
+    static __m128i encode_lookup(__m128i v) {
+        auto r = _mm_subs_epu8(v, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), v), _mm_set1_epi8(13)));
+        auto shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, Alphabet[62] - 62, Alphabet[63] - 63, 'A', 0, 0);
+        return _mm_add_epi8(v, _mm_shuffle_epi8(shift, r));
+    }
+    // 12 bytes of 16 to 16 6 bit values
+    PRIMITIVES_TARGET("ssse3")
+    static __m128i encode_split(__m128i in) {
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        auto t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        auto t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t0, t1);
+    }
+    PRIMITIVES_TARGET("ssse3")
+    static size_t encode_ssse3(const u8 *in, size_t sz, char *&p) {
+        size_t i{};
+        for (; i + 16 <= sz; i += 12, p += 16) {
+            auto v = encode_split(_mm_loadu_si128((const __m128i *)(in + i)));
+            _mm_storeu_si128((__m128i *)p, encode_lookup(v));
+        }
+        return i;
+    }
+    PRIMITIVES_TARGET("avx2")
+    static size_t encode_avx2(const u8 *in, size_t sz, char *&p) {
+        size_t i{};
+        for (; i + 28 <= sz; i += 24, p += 32) {
+            auto lo = encode_lookup(encode_split(_mm_loadu_si128((const __m128i *)(in + i))));
+            auto hi = encode_lookup(encode_split(_mm_loadu_si128((const __m128i *)(in + i + 12))));
+            _mm256_storeu_si256((__m256i *)p, _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+        }
+        return i + encode_ssse3(in + i, sz - i, p);
+    }
+
+    // 16 chars to 6 bit values, returns false on chars outside of the alphabet
+    PRIMITIVES_TARGET("ssse3")
+    static bool decode_lookup(__m128i c, __m128i &v) {
+        auto in_range = [&](char from, char to) {
+            return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(from - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(to + 1), c));
+        };
+        auto upper = in_range('A', 'Z');
+        auto lower = in_range('a', 'z');
+        auto digit = in_range('0', '9');
+        auto c62 = _mm_cmpeq_epi8(c, _mm_set1_epi8(Alphabet[62]));
+        auto c63 = _mm_cmpeq_epi8(c, _mm_set1_epi8(Alphabet[63]));
+        auto valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, c62)), c63);
+        if (_mm_movemask_epi8(valid) != 0xffff) {
+            return false;
+        }
+        auto offset = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+            _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                _mm_or_si128(_mm_and_si128(c62, _mm_set1_epi8(62 - Alphabet[62])), _mm_and_si128(c63, _mm_set1_epi8(63 - Alphabet[63])))));
+        v = _mm_add_epi8(c, offset);
+        return true;
+    }
+    // 16 6 bit values to 12 bytes in the low part
+    PRIMITIVES_TARGET("ssse3")
+    static __m128i decode_pack(__m128i v) {
+        auto merged = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        auto packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+    PRIMITIVES_TARGET("ssse3")
+    static size_t decode_ssse3(const char *in, size_t n, u8 *&p, u8 *end) {
+        size_t i{};
+        __m128i v;
+        for (; i + 16 <= n && p + 16 <= end; i += 16, p += 12) {
+            if (!decode_lookup(_mm_loadu_si128((const __m128i *)(in + i)), v)) {
+                break;
+            }
+            _mm_storeu_si128((__m128i *)p, decode_pack(v));
+        }
+        return i;
+    }
+    PRIMITIVES_TARGET("avx2")
+    static size_t decode_avx2(const char *in, size_t n, u8 *&p, u8 *end) {
+        size_t i{};
+        __m128i lo, hi;
+        for (; i + 32 <= n && p + 32 <= end; i += 32, p += 24) {
+            if (!decode_lookup(_mm_loadu_si128((const __m128i *)(in + i)), lo) ||
+                !decode_lookup(_mm_loadu_si128((const __m128i *)(in + i + 16)), hi)) {
+                break;
+            }
+            auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(decode_pack(lo)), decode_pack(hi), 1);
+            v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+            _mm256_storeu_si256((__m256i *)p, v);
+        }
+        return i + decode_ssse3(in + i, n - i, p, end);
+    }
+#endif
 };
 struct base16    : base_raw<16, "0123456789ABCDEF"_s> {};
 struct base32    : base_raw<32, "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"_s> {};
@@ -0,0 +1,53 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PRIMITIVES_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// enables an instruction set for one function, callers check cpu_features first
+#if defined(__GNUC__) || defined(__clang__)
+#define PRIMITIVES_TARGET(x) __attribute__((target(x)))
+#else
+#define PRIMITIVES_TARGET(x)
+#endif
+
+namespace primitives::templates2 {
+
+#ifdef PRIMITIVES_X86
+struct cpu_features {
+    bool ssse3{};
+    bool sse42{};
+    bool pclmul{};
+    bool avx2{};
+
+    cpu_features() {
+#ifdef _MSC_VER
+        int r[4];
+        __cpuid(r, 1);
+        ssse3 = r[2] & (1 << 9);
+        sse42 = r[2] & (1 << 20);
+        pclmul = r[2] & (1 << 1);
+        // os must save ymm registers too
+        auto osxsave = (r[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(r, 7, 0);
+        avx2 = osxsave && (r[1] & (1 << 5));
+#else
+        __builtin_cpu_init();
+        ssse3 = __builtin_cpu_supports("ssse3");
+        sse42 = __builtin_cpu_supports("sse4.2");
+        pclmul = __builtin_cpu_supports("pclmul");
+        avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+    static const cpu_features &get() {
+        static const cpu_features c;
+        return c;
+    }
+};
+#endif
+
+} // namespace primitives::templates2
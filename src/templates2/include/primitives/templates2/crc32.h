@@ -1,45 +1,295 @@
 #pragma once
 
+#include "cpu.h"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
 namespace primitives::templates2 {
 
-static const unsigned int crc32_table[] = {
-    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005, 0x2608edb8,
-    0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
-    0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75, 0x6a1936c8, 0x6ed82b7f, 0x639b0da6,
-    0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a, 0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
-    0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58, 0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84,
-    0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d, 0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb,
-    0xceb42022, 0xca753d95, 0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a,
-    0xec7dd02d, 0x34867077, 0x30476dc0, 0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
-    0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca, 0x7897ab07,
-    0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08,
-    0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba, 0xaca5c697, 0xa864db20, 0xa527fdf9,
-    0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc, 0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6,
-    0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a, 0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e, 0xf3b06b3b,
-    0xf771768c, 0xfa325055, 0xfef34de2, 0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
-    0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c,
-    0x774bb0eb, 0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
-    0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c, 0x3b5a6b9b, 0x0315d626,
-    0x07d4cb91, 0x0a97ed48, 0x0e56f0ff, 0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e, 0xf5ee4bb9,
-    0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b, 0xd727bbb6, 0xd3e6a601, 0xdea580d8,
-    0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3, 0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7,
-    0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71, 0x92b45ba8, 0x9675461f, 0x8832161a,
-    0x8cf30bad, 0x81b02d74, 0x857130c3, 0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2,
-    0x470cdd2b, 0x43cdc09c, 0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a, 0x61043093,
-    0x65c52d24, 0x119b4be9, 0x155a565e, 0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a, 0x2d15ebe3, 0x29d4f654, 0xc5a92679,
-    0xc1683bce, 0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c, 0xe3a1cbc1, 0xe760d676,
-    0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4, 0x89b8fd09, 0x8d79e0be, 0x803ac667,
-    0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662, 0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
-    0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4};
-
-auto crc32(const unsigned char *buf, int len, unsigned int init = 0xffffffff) {
-    unsigned int crc = init;
-    while (len--) {
-        crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buf) & 255];
-        buf++;
-    }
-    return crc;
+struct crc32_params {
+    // normal (msb-first) form, x^32 is implied
+    uint32_t poly;
+    // lsb-first processing
+    bool reflected;
+    uint32_t init;
+    uint32_t xorout;
+};
+
+namespace crc32_variants {
+
+// our old msb-first crc32
+inline constexpr crc32_params mpeg2{0x04c11db7, false, 0xffffffff, 0};
+// zlib, png, zip, ethernet
+inline constexpr crc32_params ieee{0x04c11db7, true, 0xffffffff, 0xffffffff};
+// iscsi, ext4, sse4.2 crc32 instruction
+inline constexpr crc32_params castagnoli{0x1edc6f41, true, 0xffffffff, 0xffffffff};
+
+} // namespace crc32_variants
+
+namespace detail::crc32 {
+
+constexpr uint32_t reflect(uint32_t v) {
+    uint32_t r{};
+    for (int i = 0; i < 32; ++i) {
+        if (v & (1u << i)) {
+            r |= 1u << (31 - i);
+        }
+    }
+    return r;
+}
+// polynomials in normal form
+constexpr uint32_t mulmod(uint32_t a, uint32_t b, uint32_t poly) {
+    uint32_t r{};
+    for (int i = 31; i >= 0; --i) {
+        r = r & 0x80000000 ? (r << 1) ^ poly : r << 1;
+        if (b & (1u << i)) {
+            r ^= a;
+        }
+    }
+    return r;
+}
+// x^n mod poly
+constexpr uint32_t xpow(unsigned n, uint32_t poly) {
+    uint32_t r = 1;
+    while (n--) {
+        r = r & 0x80000000 ? (r << 1) ^ poly : r << 1;
+    }
+    return r;
+}
+
+} // namespace detail::crc32
+
+/// Table driven (slicing-by-8/16) crc with pclmul folding and sse4.2 kernels selected at runtime.
+/// Register functions (update*) take and return the raw crc register, without init and xorout.
+template <crc32_params P>
+struct crc32_engine {
+    static inline constexpr auto reflected_poly = detail::crc32::reflect(P.poly);
+
+    // tables[k][b] - crc of byte b followed by k zero bytes
+    static inline constexpr auto tables = [] {
+        std::array<std::array<uint32_t, 256>, 16> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c;
+            if constexpr (P.reflected) {
+                c = i;
+                for (int j = 0; j < 8; ++j) {
+                    c = c & 1 ? (c >> 1) ^ reflected_poly : c >> 1;
+                }
+            } else {
+                c = i << 24;
+                for (int j = 0; j < 8; ++j) {
+                    c = c & 0x80000000 ? (c << 1) ^ P.poly : c << 1;
+                }
+            }
+            t[0][i] = c;
+        }
+        for (int k = 1; k < 16; ++k) {
+            for (int i = 0; i < 256; ++i) {
+                auto c = t[k - 1][i];
+                t[k][i] = P.reflected ? (c >> 8) ^ t[0][c & 0xff] : (c << 8) ^ t[0][c >> 24];
+            }
+        }
+        return t;
+    }();
+
+    static uint32_t update(uint32_t crc, const void *data, size_t len) {
+#ifdef PRIMITIVES_X86
+        auto &cpu = cpu_features::get();
+        if (cpu.pclmul && cpu.ssse3 && len >= 256) {
+            return update_pclmul(crc, data, len);
+        }
+        if constexpr (P.poly == crc32_variants::castagnoli.poly && P.reflected) {
+            if (cpu.sse42) {
+                return update_sse42(crc, data, len);
+            }
+        }
+#endif
+        return update_slicing<16>(crc, data, len);
+    }
+
+    /// N = 1 (plain table), 8 or 16 bytes per step
+    template <int N>
+    static uint32_t update_slicing(uint32_t crc, const void *data, size_t len) {
+        static_assert(N == 1 || N == 4 || N == 8 || N == 16);
+        auto p = (const uint8_t *)data;
+        if constexpr (N > 1) {
+            for (; len >= N; len -= N, p += N) {
+                uint32_t c;
+                std::memcpy(&c, p, 4);
+                if constexpr (P.reflected != (std::endian::native == std::endian::little)) {
+                    c = std::byteswap(c);
+                }
+                c ^= crc;
+                auto byte = [&]<int K>() -> uint8_t {
+                    if constexpr (K < 4) {
+                        return P.reflected ? c >> (8 * K) : c >> (24 - 8 * K);
+                    } else {
+                        return p[K];
+                    }
+                };
+                // unrolled at any optimization level
+                crc = [&]<int... K>(std::integer_sequence<int, K...>) {
+                    return (tables[N - 1 - K][byte.template operator()<K>()] ^ ...);
+                }(std::make_integer_sequence<int, N>{});
+            }
+        }
+        for (; len; --len, ++p) {
+            crc = P.reflected ? (crc >> 8) ^ tables[0][(crc ^ *p) & 0xff] : (crc << 8) ^ tables[0][(crc >> 24) ^ *p];
+        }
+        return crc;
+    }
+
+#ifdef PRIMITIVES_X86
+    /// crc32c only
+    PRIMITIVES_TARGET("sse4.2")
+    static uint32_t update_sse42(uint32_t crc, const void *data, size_t len) requires (P.poly == crc32_variants::castagnoli.poly && P.reflected) {
+        auto p = (const uint8_t *)data;
+#if defined(__x86_64__) || defined(_M_X64)
+        uint64_t c = crc;
+        for (; len >= 8; len -= 8, p += 8) {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            c = _mm_crc32_u64(c, v);
+        }
+        crc = (uint32_t)c;
+#endif
+        for (; len >= 4; len -= 4, p += 4) {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            crc = _mm_crc32_u32(crc, v);
+        }
+        for (; len; --len, ++p) {
+            crc = _mm_crc32_u8(crc, *p);
+        }
+        return crc;
+    }
+
+    /// Folds 64 byte blocks with carry-less multiplication, then reduces the last 16 bytes by tables.
+    PRIMITIVES_TARGET("pclmul,ssse3")
+    static uint32_t update_pclmul(uint32_t crc, const void *data, size_t len) {
+        auto p = (const uint8_t *)data;
+        if (len < 64) {
+            return update_slicing<16>(crc, p, len);
+        }
+
+        const auto k512 = _mm_set_epi64x(fold_keys[1], fold_keys[0]);
+        const auto k128 = _mm_set_epi64x(fold_keys[3], fold_keys[2]);
+
+        __m128i x[4];
+        for (int i = 0; i < 4; ++i) {
+            x[i] = load(p + 16 * i);
+        }
+        x[0] = _mm_xor_si128(x[0], P.reflected ? _mm_cvtsi32_si128(crc) : _mm_slli_si128(_mm_cvtsi32_si128(crc), 12));
+        p += 64;
+        len -= 64;
+        for (; len >= 64; len -= 64, p += 64) {
+            for (int i = 0; i < 4; ++i) {
+                x[i] = _mm_xor_si128(fold(x[i], k512), load(p + 16 * i));
+            }
+        }
+        auto r = x[0];
+        for (int i = 1; i < 4; ++i) {
+            r = _mm_xor_si128(fold(r, k128), x[i]);
+        }
+        for (; len >= 16; len -= 16, p += 16) {
+            r = _mm_xor_si128(fold(r, k128), load(p));
+        }
+
+        alignas(16) uint8_t buf[16];
+        _mm_store_si128((__m128i *)buf, P.reflected ? r : _mm_shuffle_epi8(r, pclmul_swap()));
+        crc = update_slicing<16>(0, buf, 16);
+        return update_slicing<16>(crc, p, len);
+    }
+#endif
+
+    static uint32_t compute(const void *data, size_t len) {
+        return update(P.init, data, len) ^ P.xorout;
+    }
+
+    /// crc of a+b from crc(a), crc(b) and size of b
+    static uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+        using namespace detail::crc32;
+        auto a = crc1 ^ P.xorout ^ P.init;
+        if constexpr (P.reflected) {
+            a = reflect(a);
+        }
+        // a * x^(8 * len2)
+        uint32_t m = 1;
+        for (auto sq = xpow(8, P.poly); len2; len2 >>= 1, sq = mulmod(sq, sq, P.poly)) {
+            if (len2 & 1) {
+                m = mulmod(m, sq, P.poly);
+            }
+        }
+        a = mulmod(a, m, P.poly);
+        if constexpr (P.reflected) {
+            a = reflect(a);
+        }
+        return a ^ crc2;
+    }
+
+    /// streaming crc
+    struct stream {
+        uint32_t crc{P.init};
+
+        void update(const void *data, size_t len) {
+            crc = crc32_engine::update(crc, data, len);
+        }
+        uint32_t digest() const {
+            return crc ^ P.xorout;
+        }
+        void reset() {
+            crc = P.init;
+        }
+    };
+
+private:
+#ifdef PRIMITIVES_X86
+    PRIMITIVES_TARGET("pclmul,ssse3")
+    static __m128i pclmul_swap() {
+        return _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    }
+    // msb-first data is folded as big endian lanes
+    PRIMITIVES_TARGET("pclmul,ssse3")
+    static __m128i load(const uint8_t *p) {
+        auto v = _mm_loadu_si128((const __m128i *)p);
+        return P.reflected ? v : _mm_shuffle_epi8(v, pclmul_swap());
+    }
+    PRIMITIVES_TARGET("pclmul,ssse3")
+    static __m128i fold(__m128i x, __m128i k) {
+        return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+    }
+#endif
+    // 512 and 128 bit fold multipliers for the low and high halves of a 128 bit lane
+    static inline constexpr auto fold_keys = [] {
+        using namespace detail::crc32;
+        std::array<long long, 4> k{};
+        int i{};
+        for (unsigned d : {512u, 128u}) {
+            if constexpr (P.reflected) {
+                k[i++] = (long long)reflect(xpow(d + 32, P.poly)) << 1;
+                k[i++] = (long long)reflect(xpow(d - 32, P.poly)) << 1;
+            } else {
+                k[i++] = xpow(d, P.poly);
+                k[i++] = xpow(d + 64, P.poly);
+            }
+        }
+        return k;
+    }();
+};
+
+using crc32_mpeg2 = crc32_engine<crc32_variants::mpeg2>;
+using crc32_ieee = crc32_engine<crc32_variants::ieee>;
+using crc32c = crc32_engine<crc32_variants::castagnoli>;
+
+inline constexpr auto &crc32_table = crc32_mpeg2::tables[0];
+
+// msb-first, no final xor
+inline auto crc32(const unsigned char *buf, int len, unsigned int init = 0xffffffff) {
+    return (unsigned int)crc32_mpeg2::update(init, buf, len);
 }
 
 } // namespace primitives::templates2
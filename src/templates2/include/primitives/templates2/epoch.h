@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+// Copyright (C) 2022 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace primitives::templates2 {
+
+/// Epoch based reclamation for a single writer and lock-free readers.
+/// Readers pin the current epoch while they use shared memory,
+/// the writer retires memory it has replaced and frees it when no reader can still see it.
+template <size_t MaxReaders = 128>
+struct epoch_domain {
+    /// unpins on destruction
+    struct guard {
+        std::atomic<uint64_t> *slot{};
+
+        guard() = default;
+        guard(std::atomic<uint64_t> *slot) : slot{slot} {
+        }
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+        guard(guard &&rhs) noexcept : slot{rhs.slot} {
+            rhs.slot = nullptr;
+        }
+        guard &operator=(guard &&rhs) noexcept {
+            std::swap(slot, rhs.slot);
+            return *this;
+        }
+        ~guard() {
+            if (slot) {
+                slot->store(0, std::memory_order_release);
+            }
+        }
+    };
+
+    epoch_domain() = default;
+    epoch_domain(const epoch_domain &) = delete;
+    epoch_domain &operator=(const epoch_domain &) = delete;
+    ~epoch_domain() {
+        for (auto &r : retired) {
+            r.second();
+        }
+    }
+
+    /// reader side, waits while all slots are taken
+    guard pin() {
+        for (;;) {
+            for (auto &s : slots) {
+                uint64_t free{};
+                // a stale (older) epoch only keeps more memory alive
+                if (s.epoch.load(std::memory_order_relaxed) == 0 && s.epoch.compare_exchange_strong(free, epoch.load())) {
+                    return guard{&s.epoch};
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /// writer side, f frees memory that new readers cannot reach anymore
+    void retire(std::function<void()> f) {
+        retired.emplace_back(epoch.fetch_add(1), std::move(f));
+    }
+    /// writer side, returns number of entries still waiting for readers
+    size_t reclaim() {
+        if (retired.empty()) {
+            return 0;
+        }
+        auto oldest = UINT64_MAX;
+        for (auto &s : slots) {
+            if (auto e = s.epoch.load(); e && e < oldest) {
+                oldest = e;
+            }
+        }
+        std::erase_if(retired, [oldest](auto &r) {
+            if (r.first >= oldest) {
+                return false;
+            }
+            r.second();
+            return true;
+        });
+        return retired.size();
+    }
+
+private:
+    struct alignas(64) slot {
+        // pinned epoch, 0 - free
+        std::atomic<uint64_t> epoch{};
+    };
+
+    std::atomic<uint64_t> epoch{1};
+    std::array<slot, MaxReaders> slots;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+};
+
+} // namespace primitives::templates2
@@ -1,111 +1,554 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+// Copyright (C) 2022 Egor Pugin <egor.pugin@gmail.com>
+
 #pragma once
 
-#include <filesystem>
-#include <stdexcept>
+#include "mmap_options.h"
+#include "win32.h"
+
+#include <primitives/filesystem.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string.h>
 
 #ifdef _WIN32
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
 #else
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 namespace primitives::templates2 {
 
-namespace fs = std::filesystem;
-
 #ifdef _WIN32
-struct handle {
-    HANDLE h{INVALID_HANDLE_VALUE};
-    handle() = default;
-    handle(HANDLE h, auto &&err) : h{h} {
-        if (h == INVALID_HANDLE_VALUE) {
-            err();
-        }
-    }
-    handle(HANDLE h) : handle{h, []{throw std::runtime_error{"invalid handle"};}} {
-    }
-    handle(const handle &) = delete;
-    handle &operator=(const handle &) = delete;
-    handle(handle &&rhs) {
-        std::swap(h, rhs.h);
-    }
-    handle &operator=(handle &&rhs) {
-        std::swap(h, rhs.h);
-        return *this;
-    }
-    ~handle() {
-        if (h != INVALID_HANDLE_VALUE) {
-            CloseHandle(h);
-        }
-    }
-    operator HANDLE() const { return h; }
-};
+namespace win32 = ::win32;
 #endif
 
+/// File mapping. Sizes and offsets are in elements of T unless stated otherwise.
+/// mmap_file<> is a char mapping as in the old mmap.h (mmap2.h defaulted to uint8_t).
 template <typename T = char>
 struct mmap_file {
+#ifdef _WIN32
+    /// read only
+    struct ro {
+        static inline constexpr auto access = GENERIC_READ;
+        static inline constexpr auto share_mode = FILE_SHARE_READ;
+        static inline constexpr auto disposition = OPEN_EXISTING;
+        static inline constexpr auto page_mode = PAGE_READONLY;
+        static inline constexpr auto map_mode = FILE_MAP_READ;
+    };
+    /// writes go to the file
+    struct rw {
+        static inline constexpr auto access = GENERIC_READ | GENERIC_WRITE;
+        static inline constexpr auto share_mode = FILE_SHARE_READ; // | FILE_SHARE_WRITE;
+        static inline constexpr auto disposition = OPEN_ALWAYS;
+        static inline constexpr auto page_mode = PAGE_READWRITE;
+        static inline constexpr auto map_mode = FILE_MAP_READ | FILE_MAP_WRITE;
+    };
+    /// writes are private to the mapping
+    struct cow {
+        static inline constexpr auto access = GENERIC_READ;
+        static inline constexpr auto share_mode = FILE_SHARE_READ;
+        static inline constexpr auto disposition = OPEN_EXISTING;
+        static inline constexpr auto page_mode = PAGE_WRITECOPY;
+        static inline constexpr auto map_mode = FILE_MAP_COPY;
+    };
+#else
+    /// read only
+    struct ro {
+        static inline constexpr auto open_mode = O_RDONLY;
+        static inline constexpr auto prot_mode = PROT_READ;
+        static inline constexpr auto map_type = MAP_SHARED;
+    };
+    /// writes go to the file
+    struct rw {
+        static inline constexpr auto open_mode = O_RDWR;
+        static inline constexpr auto prot_mode = PROT_READ | PROT_WRITE;
+        static inline constexpr auto map_type = MAP_SHARED;
+    };
+    /// writes are private to the mapping
+    struct cow {
+        static inline constexpr auto open_mode = O_RDONLY;
+        static inline constexpr auto prot_mode = PROT_READ | PROT_WRITE;
+        static inline constexpr auto map_type = MAP_PRIVATE;
+    };
+#endif
+    /// rw mapping that grows in place: address space for reserve bytes is taken up front
+    /// and new pages are mapped after the old ones, so pointers stay valid until the reserve is exceeded
+    struct growable : rw {
+        uint64_t reserve = sizeof(void *) == 8 ? 1ULL << 36 : 1ULL << 28;
+    };
+    /// up to the end of the file
+    static inline constexpr uint64_t npos = -1;
+    /// part of the file, in bytes; offset does not need to be aligned
+    struct range {
+        uint64_t offset{};
+        uint64_t size = npos;
+    };
+    template <typename Mode>
+    static inline constexpr bool is_mode =
+        std::same_as<Mode, ro> || std::same_as<Mode, rw> || std::same_as<Mode, cow> || std::same_as<Mode, growable>;
+
     using size_type = uint64_t;
 
+    path fn;
 #ifdef _WIN32
-    handle f;
-    handle m;
+    win32::handle f, m;
 #else
     int fd{-1};
+    // bytes of address space taken by a growable mapping
+    size_type reserved{};
 #endif
-    T *p{};
+    // bytes of the file mapping from its aligned start
+    size_type mapped{};
+    // mapping starts at range.offset rounded down to the allocation granularity
+    size_type delta{};
+    range part;
+    // rw and growable
+    bool writable{};
+    bool copy_on_write{};
+    T *p{nullptr};
     size_type sz{};
+    mmap_options options;
+    /// When set, an address range that is left on growth or close is passed here instead of being unmapped,
+    /// so concurrent readers can finish with it. Free it later with unmap().
+    std::function<void(void *, size_type)> retire;
 
     mmap_file() = default;
-    mmap_file(const fs::path &fn) {
-        sz = fs::file_size(fn);
+    mmap_file(const fs::path &fn, mmap_options options = {}) : fn{fn}, options{options} {
+        open(ro{});
+    }
+    template <typename Mode>
+    requires is_mode<Mode>
+    mmap_file(const fs::path &fn, Mode mode, mmap_options options = {}) : fn{fn}, options{options} {
+        open(mode);
+    }
+    template <typename Mode>
+    requires is_mode<Mode>
+    mmap_file(const fs::path &fn, Mode mode, range part, mmap_options options = {}) : fn{fn}, part{part}, options{options} {
+        open(mode);
+    }
+    mmap_file(const mmap_file &) = delete;
+    mmap_file &operator=(const mmap_file &) = delete;
+    T *open() {
+        return open(ro{});
+    }
+    T *open(const fs::path &fn) {
+        this->fn = fn;
+        return open(ro{});
+    }
+    T *open(const fs::path &fn, auto v) {
+        this->fn = fn;
+        return open(v);
+    }
+    T *open(auto mode) {
+        auto ex = fs::exists(fn);
+        if constexpr (!std::derived_from<decltype(mode), rw>) {
+            if (!ex) {
+                throw std::runtime_error{"file does not exist: "s + fn.string()};
+            }
+        }
+        if constexpr (std::same_as<decltype(mode), growable>) {
+            if (part.offset) {
+                throw std::runtime_error{"growable mapping must start at the beginning of the file"};
+            }
+#ifndef _WIN32
+            reserved = std::max(reserved, round_to_page(mode.reserve));
+#endif
+        }
+        writable = std::derived_from<decltype(mode), rw>;
+        copy_on_write = std::same_as<decltype(mode), cow>;
+
+        auto filesize = !ex ? 0 : fs::file_size(fn);
+        auto bytes = std::min(part.size, filesize - std::min(part.offset, filesize));
+        sz = bytes / sizeof(T);
+        bytes = sz * sizeof(T);
+        delta = part.offset % detail::mmap::allocation_granularity();
+        mapped = delta + bytes;
         if (sz == 0) {
-            return;
+            mapped = 0;
+            return p;
         }
+        auto start = part.offset - delta;
 #ifdef _WIN32
-        f = handle{CreateFileW(fn.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0),
-            [&]{ throw std::runtime_error{"cannot open file: " + fn.string()}; }
-        };
-        m = CreateFileMappingW(f, 0, PAGE_READONLY, 0, sz, 0);
-        if (m == 0) {
-            throw std::runtime_error{"cannot create file mapping"};
-        }
-        p = (T *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, sz);
-        if (!p) {
-            throw std::runtime_error{"cannot map file"};
+        f = win32::handle{CreateFileW(fn.wstring().c_str(), mode.access, mode.share_mode, 0, mode.disposition,
+                                      FILE_ATTRIBUTE_NORMAL | detail::mmap::file_flags(options), 0),
+                          [&] {
+                              throw win32::winapi_exception{"cannot open file: " + fn.string()};
+                          }};
+        m = win32::handle{CreateFileMappingW(f, 0, mode.page_mode, 0, 0, 0), [&] {
+                              throw win32::winapi_exception{"cannot create file mapping"};
+                          }};
+        auto base = (char *)MapViewOfFile(m, mode.map_mode, (DWORD)(start >> 32), (DWORD)start, mapped);
+        if (!base) {
+            throw win32::winapi_exception{"cannot map file"};
         }
 #else
-        fd = open(fn.string().c_str(), O_RDONLY);
+        fd = ::open(fn.string().c_str(), mode.open_mode);
         if (fd == -1) {
             throw std::runtime_error{"cannot open file: " + fn.string()};
         }
-        p = (char *)mmap(0, sz, PROT_READ, MAP_PRIVATE, fd, 0);
-        if (p == MAP_FAILED) {
-            close(fd);
+        void *base;
+        if (reserved) {
+            // inaccessible and uncommitted until the file is mapped over it
+            reserved = std::max(reserved, round_to_page(mapped));
+            base = mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base != MAP_FAILED &&
+                mmap(base, mapped, mode.prot_mode, mode.map_type | MAP_FIXED | detail::mmap::map_flags(options), fd, start) == MAP_FAILED) {
+                munmap(base, reserved);
+                base = MAP_FAILED;
+            }
+        } else {
+            base = mmap(0, mapped, mode.prot_mode, mode.map_type | detail::mmap::map_flags(options), fd, start);
+        }
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            fd = -1;
             throw std::runtime_error{"cannot create file mapping"};
         }
 #endif
+        p = (T *)((char *)base + delta);
+        detail::mmap::advise(base, mapped, options);
+        return p;
     }
-    ~mmap_file() {
+    static void unmap(void *base, size_type len) {
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(base, len);
+#endif
+    }
+    void close() {
+        auto base = (char *)p - delta;
 #ifdef _WIN32
+        auto len = mapped;
+#else
+        auto len = reserved ? reserved : mapped;
+#endif
         if (p) {
-            UnmapViewOfFile(p);
+            // the view stays valid after its handles are closed
+            retire ? retire(base, len) : unmap(base, len);
         }
+#ifdef _WIN32
+        m.reset();
+        f.reset();
 #else
-        close(fd);
+        if (fd != -1) {
+            ::close(fd);
+        }
+        fd = -1;
 #endif
+        mapped = 0;
+        p = nullptr;
+    }
+    ~mmap_file() {
+        close();
+    }
+    auto &operator[](size_type i) {
+        return p[i];
+    }
+    const auto &operator[](size_type i) const {
+        return p[i];
+    }
+    bool eof(size_type pos) const {
+        return pos >= sz;
+    }
+    operator T *() const {
+        return p;
     }
-    auto &operator[](int i) { return p[i]; }
-    const auto &operator[](int i) const { return p[i]; }
-    bool eof(size_type pos) const { return pos >= sz; }
-    operator T*() const { return p; }
     template <typename U>
-    operator U*() const { return (U*)p; }
+    operator U *() const {
+        return (U *)p;
+    }
+
+    auto begin() const {
+        return p;
+    }
+    auto end() const {
+        return p + sz;
+    }
+    auto size() const {
+        return sz;
+    }
+    auto size_bytes() const {
+        return sz * sizeof(T);
+    }
+    std::span<T> span() const {
+        return {p, (size_t)sz};
+    }
+    std::span<T> span(size_type offset, size_type n = -1) const {
+        offset = std::min(offset, sz);
+        return {p + offset, (size_t)std::min(n, sz - offset)};
+    }
 
-    auto begin() const { return p; }
-    auto end() const { return p+sz; }
+    /// Writes dirty pages of [offset, offset + n) to the file.
+    /// async only schedules the write back.
+    void flush(size_type offset = 0, size_type n = -1, bool async = false) const {
+        auto s = span(offset, n);
+        if (s.empty() || !writable) {
+            return;
+        }
+        auto page = detail::mmap::page_size();
+        auto from = (char *)s.data() - ((uintptr_t)s.data() % page);
+        auto len = (char *)(s.data() + s.size()) - from;
+#ifdef _WIN32
+        WINAPI_CALL(FlushViewOfFile(from, len));
+        if (!async) {
+            WINAPI_CALL(FlushFileBuffers(f));
+        }
+#else
+        if (msync(from, len, async ? MS_ASYNC : MS_SYNC) == -1) {
+            throw std::runtime_error{"cannot flush file mapping: " + fn.string()};
+        }
+#endif
+    }
+
+    /// read [offset, offset + n) elements ahead in the background
+    void prefetch(size_type offset, size_type n) const {
+        auto s = span(offset, n);
+        auto base = (char *)p - delta;
+        detail::mmap::prefetch(base, (char *)s.data() - base, s.size_bytes());
+    }
+    /// release memory of [offset, offset + n) elements, the next access reads them again
+    void drop(size_type offset, size_type n) const {
+#ifdef _WIN32
+        int fd = -1;
+#endif
+        // would discard private changes
+        if (copy_on_write) {
+            return;
+        }
+        auto s = span(offset, n);
+        auto base = (char *)p - delta;
+        detail::mmap::drop(base, (char *)s.data() - base, s.size_bytes(), fd, part.offset - delta);
+    }
+
+    T *alloc_raw(size_type sz) {
+        auto oldsz = this->sz;
+        resize(sz);
+        return p + oldsz;
+    }
+    T *alloc(size_type sz) {
+        auto oldsz = this->sz;
+        resize(oldsz ? this->sz * 2 + sz : sz * 2);
+        return p + oldsz;
+    }
+    /// Sets file size to n elements. Writable mappings are grown without remapping the old pages.
+    void resize(size_type n) {
+        if (copy_on_write || part.offset || part.size != npos) {
+            throw std::runtime_error{"cannot resize copy-on-write or partial mapping: " + fn.string()};
+        }
+#ifndef _WIN32
+        if (p && writable) {
+            if (ftruncate(fd, n * sizeof(T)) == -1) {
+                throw std::runtime_error{"cannot resize file: " + fn.string()};
+            }
+            remap(n * sizeof(T));
+            sz = n;
+            return;
+        }
+#endif
+        close();
+        if (!fs::exists(fn)) {
+            if (!fn.parent_path().empty()) {
+                fs::create_directories(fn.parent_path());
+            }
+            std::ofstream{fn};
+        }
+        fs::resize_file(fn, n * sizeof(T));
+        open(rw{});
+    }
+
+private:
+#ifndef _WIN32
+    static size_type round_to_page(size_type n) {
+        auto page = detail::mmap::page_size();
+        return (n + page - 1) / page * page;
+    }
+    void remap(size_type bytes) {
+        auto have = round_to_page(mapped);
+        auto need = round_to_page(bytes);
+        if (need <= have) {
+            // without a reserve close() and growth know only mapped bytes, so the tail is given back now
+            if (!reserved && need < have) {
+                retire ? retire((char *)p + need, have - need) : unmap((char *)p + need, have - need);
+                if (!need) {
+                    p = nullptr;
+                }
+            }
+            mapped = bytes;
+            return;
+        }
+        if (need <= reserved) {
+            // in place, old pages are untouched
+            if (mmap((char *)p + have, need - have, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | detail::mmap::map_flags(options), fd, have) == MAP_FAILED) {
+                throw std::runtime_error{"cannot grow file mapping"};
+            }
+            detail::mmap::advise((char *)p + have, need - have, options);
+            mapped = bytes;
+            return;
+        }
+        if (reserved) {
+            // out of reserve, move to a twice bigger one
+            auto newreserved = std::max(reserved * 2, need);
+            auto r = mmap(0, newreserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (r == MAP_FAILED || mmap(r, need, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | detail::mmap::map_flags(options), fd, 0) == MAP_FAILED) {
+                if (r != MAP_FAILED) {
+                    munmap(r, newreserved);
+                }
+                throw std::runtime_error{"cannot grow file mapping"};
+            }
+            retire ? retire(p, reserved) : unmap(p, reserved);
+            p = (T *)r;
+            mapped = bytes;
+            reserved = newreserved;
+            detail::mmap::advise(p, need, options);
+            return;
+        }
+        void *r;
+#ifdef __linux__
+        if (!retire) {
+            // the kernel moves page tables, no copying and refaulting
+            r = mremap(p, have, need, MREMAP_MAYMOVE);
+        } else
+#endif
+        {
+            r = mmap(0, need, PROT_READ | PROT_WRITE, MAP_SHARED | detail::mmap::map_flags(options), fd, 0);
+            if (r != MAP_FAILED) {
+                retire ? retire(p, have) : unmap(p, have);
+            }
+        }
+        if (r == MAP_FAILED) {
+            throw std::runtime_error{"cannot grow file mapping"};
+        }
+        p = (T *)r;
+        mapped = bytes;
+        detail::mmap::advise(p, need, options);
+    }
+#endif
+
+public:
+    /// Byte stream over the mapping, writes grow the file.
+    struct stream {
+        mmap_file *m_{};
+        size_type offset{0};
+        bool ok{true};
+
+        mmap_file &m() const {
+            return *m_;
+        }
+        uint8_t *data() const {
+            return (uint8_t *)m().p;
+        }
+
+        /// bytes
+        auto size() const {
+            return m().size_bytes();
+        }
+        bool has_room(auto sz) const {
+            return offset + sz <= size();
+        }
+        explicit operator bool() const {
+            return ok && offset != -1 && offset < size();
+        }
+        void grow(size_type bytes) {
+            m().alloc((bytes + sizeof(T) - 1) / sizeof(T));
+        }
+        /// room for several writes with one check
+        void reserve(size_type bytes) {
+            if (!has_room(bytes)) {
+                grow(bytes);
+            }
+        }
+
+        auto write_record(size_type sz) {
+            if (!has_room(sz + sizeof(sz))) {
+                grow(sz + sizeof(sz));
+            }
+            *this << sz;
+            auto oldoff = offset;
+            offset += sz;
+            return stream{m_, oldoff};
+        }
+        auto read_record() {
+            size_type sz;
+            if (!has_room(sizeof(sz))) {
+                return stream{m_, (size_type)-1};
+            }
+            *this >> sz;
+            if (sz == 0) {
+                offset -= sizeof(sz);
+                return stream{m_, (size_type)-1};
+            }
+            if (!has_room(sz)) {
+                return stream{m_, (size_type)-1};
+            }
+            auto oldoff = offset;
+            offset += sz;
+            return stream{m_, oldoff};
+        }
+
+        template <typename U>
+        stream &operator>>(U &v) {
+            if (!has_room(sizeof(U))) {
+                throw std::runtime_error{"no more data"};
+            }
+            memcpy(&v, data() + offset, sizeof(U));
+            offset += sizeof(U);
+            return *this;
+        }
+        template <typename U>
+        stream &operator<<(const U &v) {
+            if (!has_room(sizeof(U))) {
+                grow(sizeof(U));
+            }
+            memcpy(data() + offset, &v, sizeof(U));
+            offset += sizeof(U);
+            return *this;
+        }
+
+        stream &operator>>(path &p) {
+            auto make_eof = [&, &s = *this]() -> stream & {
+                p.clear();
+                ok = false;
+                return s;
+            };
+            uint64_t len;
+            if (!has_room(sizeof(len))) {
+                return make_eof();
+            }
+            operator>>(len);
+            if (!has_room(len) || len == 0) {
+                offset -= sizeof(len);
+                return make_eof();
+            }
+            p.assign((const char8_t *)data() + offset, (const char8_t *)data() + offset + len);
+            offset += len;
+            return *this;
+        }
+        stream &operator<<(const path &p) {
+            auto s = p.u8string();
+            uint64_t len = s.size();
+            if (!has_room(len + sizeof(len))) {
+                grow(len + sizeof(len));
+            }
+            operator<<(len);
+            memcpy(data() + offset, s.data(), len);
+            offset += len;
+            return *this;
+        }
+
+        template <typename U>
+        auto make_span(uint64_t n) {
+            return std::span<U>((U *)(data() + offset), (U *)(data() + offset) + n);
+        }
+    };
+    auto get_stream() {
+        return stream{this};
+    }
 };
 
 } // namespace primitives::templates2
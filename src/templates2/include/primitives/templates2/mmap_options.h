@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace primitives::templates2 {
+
+/// Kernel hints for mmap_file. All of them are best effort and never fail the mapping.
+struct mmap_options {
+    enum access_pattern {
+        normal,
+        // aggressive read ahead, pages behind are freed sooner
+        sequential,
+        // no read ahead
+        random,
+    };
+    access_pattern access{normal};
+    /// start reading the whole mapping in the background
+    bool will_need{};
+    /// fault all pages in at map time (linux MAP_POPULATE, windows prefetch)
+    bool populate{};
+    /// transparent huge pages (linux, file mappings need filesystem support)
+    bool huge_pages{};
+};
+
+namespace detail::mmap {
+
+#ifdef _WIN32
+inline DWORD file_flags(const mmap_options &o) {
+    switch (o.access) {
+    case mmap_options::sequential:
+        return FILE_FLAG_SEQUENTIAL_SCAN;
+    case mmap_options::random:
+        return FILE_FLAG_RANDOM_ACCESS;
+    default:
+        return 0;
+    }
+}
+#else
+inline int map_flags(const mmap_options &o) {
+#ifdef MAP_POPULATE
+    if (o.populate) {
+        return MAP_POPULATE;
+    }
+#endif
+    return 0;
+}
+#endif
+
+inline size_t page_size() {
+#ifdef _WIN32
+    static const size_t page = [] {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return (size_t)si.dwPageSize;
+    }();
+#else
+    static const size_t page = sysconf(_SC_PAGESIZE);
+#endif
+    return page;
+}
+// mapping offsets must be aligned to it
+inline size_t allocation_granularity() {
+#ifdef _WIN32
+    static const size_t g = [] {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return (size_t)si.dwAllocationGranularity;
+    }();
+    return g;
+#else
+    return page_size();
+#endif
+}
+
+// [base + offset, base + offset + len) widened to whole pages, base is page aligned
+inline void page_range(void *base, uint64_t offset, uint64_t len, void *&start, size_t &size) {
+    auto page = page_size();
+    auto from = offset / page * page;
+    start = (char *)base + from;
+    size = (offset + len - from + page - 1) / page * page;
+}
+
+inline void prefetch(void *base, uint64_t offset, uint64_t len) {
+    if (!base || !len) {
+        return;
+    }
+    void *start;
+    size_t size;
+    page_range(base, offset, len, start, size);
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY r{start, size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &r, 0);
+#else
+    madvise(start, size, MADV_WILLNEED);
+#endif
+}
+
+// unmaps pages from the process and evicts clean ones from the page cache, data stays in the file
+// base is mapped from file_offset
+inline void drop(void *base, uint64_t offset, uint64_t len, [[maybe_unused]] int fd, [[maybe_unused]] uint64_t file_offset = 0) {
+    if (!base || !len) {
+        return;
+    }
+    void *start;
+    size_t size;
+    page_range(base, offset, len, start, size);
+#ifdef _WIN32
+    // removes pages from the working set
+    VirtualUnlock(start, size);
+#else
+    madvise(start, size, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+    if (fd != -1) {
+        posix_fadvise(fd, file_offset + ((char *)start - (char *)base), size, POSIX_FADV_DONTNEED);
+    }
+#endif
+#endif
+}
+
+inline void advise(void *p, size_t len, const mmap_options &o) {
+    if (!p || !len) {
+        return;
+    }
+#ifdef _WIN32
+    if (o.will_need || o.populate) {
+        prefetch(p, 0, len);
+    }
+#else
+    if (o.access == mmap_options::sequential) {
+        madvise(p, len, MADV_SEQUENTIAL);
+    } else if (o.access == mmap_options::random) {
+        madvise(p, len, MADV_RANDOM);
+    }
+    if (o.will_need) {
+        madvise(p, len, MADV_WILLNEED);
+    }
+#ifdef MADV_HUGEPAGE
+    if (o.huge_pages) {
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+#endif
+#ifndef MAP_POPULATE
+    if (o.populate) {
+        madvise(p, len, MADV_WILLNEED);
+    }
+#endif
+#endif
+}
+
+} // namespace detail::mmap
+
+} // namespace primitives::templates2
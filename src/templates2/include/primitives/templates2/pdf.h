@@ -1,9 +1,12 @@
 #pragma once
 
-#include "mmap2.h"
+#include "mmap.h"
 
 #include <primitives/filesystem.h>
 
+#include <charconv>
+#include <map>
+
 namespace primitives::templates2 {
 
 struct pdf {
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+// Copyright (C) 2022 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "epoch.h"
+#include "mmap.h"
+
+#include <ranges>
+#include <type_traits>
+
+namespace primitives::templates2 {
+
+/// Append-only file of variable size records with O(1) access by number.
+/// Data: [u64 size + 1][bytes][zero padding to 8] per record, 0 marks the end (the file grows geometrically).
+/// Index: sidecar "<fn>.index" of [u64 count][u64 offset of record i]...
+/// Records missing from the index (crash, deleted index) are recovered from the data on open.
+/// Records are 8 byte aligned, so trivially copyable structs are viewed in place without copying.
+///
+/// One thread appends, any number of threads may read through read() at the same time without locks.
+/// The writer publishes the record count with release semantics after the records are written,
+/// and old mappings left by growth are unmapped only when no reader holds an epoch that can see them.
+struct record_file {
+    using size_type = uint64_t;
+    static inline constexpr size_type alignment = 8;
+
+    /// consistent view of the first size() records, keeps the mappings alive
+    struct snapshot {
+        epoch_domain<>::guard guard;
+        const uint8_t *data{};
+        const size_type *index{};
+        size_type n{};
+
+        size_type size() const {
+            return n;
+        }
+        bool empty() const {
+            return n == 0;
+        }
+        std::span<const uint8_t> operator[](size_type i) const {
+            return record(data, index, i);
+        }
+        template <typename U>
+        requires std::is_trivially_copyable_v<U>
+        std::span<const U> view(size_type i) const {
+            return record_file::view<U>((*this)[i]);
+        }
+        template <typename U>
+        requires std::is_trivially_copyable_v<U>
+        const U &get(size_type i) const {
+            return record_file::get<U>((*this)[i]);
+        }
+    };
+
+    mmap_file<uint8_t> data;
+    mmap_file<uint64_t> index;
+
+    /// reserve - address space for the data mapping, it moves (and old one is retired) when exceeded
+    record_file(const path &fn, uint64_t reserve = mmap_file<uint8_t>::growable{}.reserve)
+        : data{fn, growable(reserve)}, index{path{fn} += ".index", mmap_file<uint64_t>::growable{}} {
+        auto n = count();
+        // corrupt count (n + 1 overflows), index of another or truncated data - rescan everything
+        if (n >= index.sz || (n && !valid_record(index[n]))) {
+            n = 0;
+        }
+        end = n ? index[n] + record_size(header(index[n]) - 1) : 0;
+        // not indexed tail
+        auto s = data.get_stream();
+        for (s.offset = end; s.has_room(sizeof(size_type));) {
+            size_type h;
+            s >> h;
+            if (!h || h - 1 > data.size_bytes() || !s.has_room(record_size(h - 1) - sizeof(h))) {
+                break;
+            }
+            reserve_index(n + 1);
+            index[++n] = end;
+            end += record_size(h - 1);
+            s.offset = end;
+        }
+        if (n != count()) {
+            reserve_index(n);
+            index[0] = n;
+        }
+        data.retire = [this](void *p, size_type n) {
+            pending.emplace_back([p, n] {
+                mmap_file<uint8_t>::unmap(p, n);
+            });
+        };
+        index.retire = [this](void *p, size_type n) {
+            pending.emplace_back([p, n] {
+                mmap_file<uint64_t>::unmap(p, n);
+            });
+        };
+        publish();
+    }
+    record_file(const record_file &) = delete;
+    record_file &operator=(const record_file &) = delete;
+    ~record_file() {
+        data.retire = {};
+        index.retire = {};
+        for (auto &f : pending) {
+            f();
+        }
+    }
+
+    size_type size() const {
+        return count();
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    /// bytes used by records
+    size_type size_bytes() const {
+        return end;
+    }
+
+    std::span<const uint8_t> operator[](size_type i) const {
+        return record(data.p, index.p, i);
+    }
+    std::span<const uint8_t> at(size_type i) const {
+        if (i >= size()) {
+            throw std::runtime_error{"record number is out of range"};
+        }
+        return (*this)[i];
+    }
+    /// record as an array of U
+    template <typename U>
+    requires std::is_trivially_copyable_v<U>
+    std::span<const U> view(size_type i) const {
+        return view<U>((*this)[i]);
+    }
+    template <typename U>
+    requires std::is_trivially_copyable_v<U>
+    const U &get(size_type i) const {
+        return get<U>((*this)[i]);
+    }
+
+    /// Reader side, safe to call from any thread while the writer appends.
+    /// Hold the snapshot only while its records are used, it delays unmapping of old mappings.
+    snapshot read() const {
+        snapshot s{epochs.pin()};
+        auto idx = index_p.load();
+        if (!idx) {
+            return s;
+        }
+        // count is stored after the pointers, so pointers loaded after it cover all counted records
+        s.n = std::atomic_ref{const_cast<size_type &>(idx[0])}.load(std::memory_order_acquire);
+        s.data = data_p.load();
+        s.index = index_p.load();
+        return s;
+    }
+    /// unmaps retired mappings no reader can see, returns number of them still in use
+    /// Writer thread only, like append(): retired mappings are not guarded against concurrent access.
+    size_type reclaim() {
+        return epochs.reclaim();
+    }
+
+    /// Appends are not thread safe, use a single writer thread.
+    /// v is a trivially copyable object or a contiguous range of them (strings, vectors, spans)
+    /// returns record number
+    size_type append(const auto &v) {
+        return append_many(std::span{&v, 1});
+    }
+    /// Appends every element as a record, the files are grown once per batch.
+    /// returns number of the first record
+    template <std::ranges::forward_range R>
+    size_type append_many(R &&records) {
+        size_type total{}, n{};
+        for (auto &&r : records) {
+            total += record_size(bytes(r).size());
+            ++n;
+        }
+        auto first = count();
+        reserve_index(first + n);
+        auto s = data.get_stream();
+        s.offset = end;
+        s.reserve(total);
+
+        auto p = data.p + end;
+        auto idx = index.p + first + 1;
+        for (auto &&r : records) {
+            auto b = bytes(r);
+            size_type h = b.size() + 1;
+            memcpy(p, &h, sizeof(h));
+            memcpy(p + sizeof(h), b.data(), b.size());
+            // padding may hold garbage of a record that was not indexed before a crash
+            memset(p + sizeof(h) + b.size(), 0, record_size(b.size()) - sizeof(h) - b.size());
+            *idx++ = p - data.p;
+            p += record_size(b.size());
+        }
+        end = p - data.p;
+        publish();
+        // records are visible after the count is written
+        std::atomic_ref{index[0]}.store(first + n, std::memory_order_release);
+        if (!pending.empty()) {
+            // new readers get the new mappings from now on
+            for (auto &f : pending) {
+                epochs.retire(std::move(f));
+            }
+            pending.clear();
+        }
+        epochs.reclaim();
+        return first;
+    }
+
+private:
+    size_type end{};
+    mutable epoch_domain<> epochs;
+    std::atomic<const uint8_t *> data_p{};
+    std::atomic<const size_type *> index_p{};
+    // mappings replaced during the current append
+    std::vector<std::function<void()>> pending;
+
+    static mmap_file<uint8_t>::growable growable(uint64_t reserve) {
+        mmap_file<uint8_t>::growable g;
+        g.reserve = reserve;
+        return g;
+    }
+    static std::span<const uint8_t> record(const uint8_t *data, const size_type *index, size_type i) {
+        auto off = index[i + 1];
+        size_type h;
+        memcpy(&h, data + off, sizeof(h));
+        return {data + off + sizeof(size_type), (size_t)h - 1};
+    }
+    template <typename U>
+    static std::span<const U> view(std::span<const uint8_t> r) {
+        static_assert(alignof(U) <= alignment);
+        return {(const U *)r.data(), r.size() / sizeof(U)};
+    }
+    template <typename U>
+    static const U &get(std::span<const uint8_t> r) {
+        auto v = view<U>(r);
+        if (v.empty()) {
+            throw std::runtime_error{"record is smaller than the type"};
+        }
+        return v[0];
+    }
+    void publish() {
+        data_p.store(data.p);
+        index_p.store(index.p);
+    }
+
+    static size_type record_size(size_type n) {
+        return sizeof(size_type) + (n + alignment - 1) / alignment * alignment;
+    }
+    size_type header(size_type off) const {
+        size_type h;
+        memcpy(&h, data.p + off, sizeof(h));
+        return h;
+    }
+    size_type count() const {
+        return index.sz ? index[0] : 0;
+    }
+    // whole record at off lies within the data
+    bool valid_record(size_type off) const {
+        auto sz = data.size_bytes();
+        if (off % alignment || sz < sizeof(size_type) || off > sz - sizeof(size_type)) {
+            return false;
+        }
+        auto h = header(off);
+        return h && h - 1 <= sz && record_size(h - 1) <= sz - off;
+    }
+    void reserve_index(size_type n) {
+        if (index.sz < n + 1) {
+            index.alloc(n + 1 - index.sz);
+        }
+    }
+    template <typename U>
+    static std::span<const uint8_t> bytes(const U &v) {
+        if constexpr (std::ranges::contiguous_range<U>) {
+            static_assert(std::is_trivially_copyable_v<std::ranges::range_value_t<U>>);
+            return {(const uint8_t *)std::ranges::data(v), std::ranges::size(v) * sizeof(std::ranges::range_value_t<U>)};
+        } else {
+            static_assert(std::is_trivially_copyable_v<U>);
+            return {(const uint8_t *)&v, sizeof(v)};
+        }
+    }
+};
+
+} // namespace primitives::templates2
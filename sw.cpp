@@ -314,14 +314,15 @@ void build(Solution &s)
     patch.Public += filesystem, templates;
 
     ADD_LIBRARY(http);
-    http.Public += filesystem, templates,
+    http.Public += filesystem, templates, templates2,
         "org.sw.demo.badger.curl.libcurl"_dep;
     if (http.getBuildSettings().TargetOS.Type == OSType::Windows || http.getBuildSettings().TargetOS.Type == OSType::Mingw)
         http += "Winhttp.lib"_slib;
 
     ADD_LIBRARY(hash);
-    hash.Public += filesystem,
+    hash.Public += filesystem, executor,
         "org.sw.demo.aleksey14.rhash"_dep,
+        "org.sw.demo.Cyan4973.xxHash"_dep,
         "org.sw.demo.openssl.crypto"_dep;
     hash.Public += "src/hash.natvis";
 
@@ -584,8 +585,8 @@ void build(Solution &s)
     auto &test_main = add_test("main");
     if (test_main.getCompilerType() == CompilerType::MSVC)
         test_main.CompileOptions.push_back("/utf-8"); // path tests
-    test_main += command, date_time,
-        executor, hash, yaml, emitter, http,
+    test_main += command, cron, date_time,
+        executor, hash, yaml, emitter, http, templates2,
         "org.sw.demo.nlohmann.json"_dep;
 
     auto &test_db = add_test("db");